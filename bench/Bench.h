@@ -0,0 +1,65 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "MBB.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+// Helpers shared by the benchmark programs
+
+using Clock = std::chrono::steady_clock;
+
+inline auto microsSince(Clock::time_point start) -> double {
+  return std::chrono::duration<double, std::micro>(Clock::now() - start)
+      .count();
+}
+
+// Value below which a fraction `p` of `values` lies
+inline auto percentile(std::vector<double> values, double p) -> double {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  auto last = static_cast<double>(values.size() - 1);
+  return values[static_cast<size_t>(p * last)];
+}
+
+// Size parameter from the command line, so quick runs can pass less
+inline auto argumentOr(int argc, char **argv, int index, size_t fallback)
+    -> size_t {
+  return argc > index ? std::stoul(argv[index]) : fallback;
+}
+
+inline auto uniformPoints(size_t n, float range, uint32_t seed)
+    -> std::vector<Point<float>> {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> dist(0.0F, range);
+  std::vector<Point<float>> points;
+  points.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    float x = dist(rng);
+    points.emplace_back(x, dist(rng));
+  }
+  return points;
+}
+
+// Square query boxes of the given side, placed uniformly
+inline auto squareQueries(size_t n, float range, float side, uint32_t seed)
+    -> std::vector<QueryBox<float>> {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> dist(0.0F, range - side);
+  std::vector<QueryBox<float>> queries;
+  queries.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    float x = dist(rng);
+    float y = dist(rng);
+    queries.emplace_back(Point<float>(x, y), Point<float>(x + side, y + side));
+  }
+  return queries;
+}
+
+#endif // BENCH_H
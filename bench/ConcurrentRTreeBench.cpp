@@ -0,0 +1,103 @@
+#include "Bench.h"
+#include "ConcurrentRTree.h"
+#include "Rtree.h"
+#include <cstdio>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+// Mixed inserts and count queries from several threads against
+// - an RTree behind one shared_mutex,
+// - a ConcurrentRTree behind the same single lock, which isolates the cost
+//   of its node layout from the latching,
+// - a ConcurrentRTree using its per-node latches.
+// Scaling across cores shows only when the host has more cores than
+// threads.
+// Usage: ConcurrentRTreeBench [points] [operations]
+
+namespace {
+constexpr float RANGE = 100000;
+constexpr float SIDE = 300;
+
+// Runs `threads` workers splitting `operations` between them; each does a
+// write with probability `writes` and a query otherwise. Returns ops/s.
+template <typename Insert, typename Count>
+auto mixed(size_t threads, size_t operations, double writes, Insert insert,
+           Count count) -> double {
+  auto start = Clock::now();
+  std::vector<std::thread> workers;
+  for (size_t id = 0; id < threads; ++id) {
+    workers.emplace_back([=] {
+      std::mt19937 rng(static_cast<uint32_t>(id));
+      std::uniform_real_distribution<float> dist(0.0F, RANGE - SIDE);
+      std::uniform_real_distribution<double> coin(0.0, 1.0);
+      for (size_t i = 0; i < operations / threads; ++i) {
+        float x = dist(rng);
+        float y = dist(rng);
+        if (coin(rng) < writes) {
+          insert(Point<float>(x, y));
+        } else {
+          count(QueryBox<float>(Point<float>(x, y),
+                                Point<float>(x + SIDE, y + SIDE)));
+        }
+      }
+    });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  return static_cast<double>(operations) / microsSince(start) * 1e6;
+}
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+  size_t n = argumentOr(argc, argv, 1, 100000);
+  size_t operations = argumentOr(argc, argv, 2, 20000);
+  auto points = uniformPoints(n, RANGE, 7);
+  std::printf("%u hardware threads, %zu points, %zu operations\n",
+              std::thread::hardware_concurrency(), n, operations);
+  std::printf("threads  writes  RTree+lock  latched+lock  latched  (kops/s)\n");
+
+  for (size_t threads : {1, 4, 16}) {
+    for (double writes : {0.1, 0.5}) {
+      RTree<float> plain(4, 16);
+      ConcurrentRTree<float> locked(4, 16);
+      ConcurrentRTree<float> latched(4, 16);
+      for (const auto &point : points) {
+        plain.insert(point);
+        locked.insert(point);
+        latched.insert(point);
+      }
+      std::shared_mutex mutex;
+
+      double plainRate = mixed(
+          threads, operations, writes,
+          [&](const Point<float> &point) {
+            std::unique_lock lock(mutex);
+            plain.insert(point);
+          },
+          [&](const QueryBox<float> &q) {
+            std::shared_lock lock(mutex);
+            (void)plain.count(q);
+          });
+      double lockedRate = mixed(
+          threads, operations, writes,
+          [&](const Point<float> &point) {
+            std::unique_lock lock(mutex);
+            locked.insert(point);
+          },
+          [&](const QueryBox<float> &q) {
+            std::shared_lock lock(mutex);
+            (void)locked.count(q);
+          });
+      double latchedRate = mixed(
+          threads, operations, writes,
+          [&](const Point<float> &point) { latched.insert(point); },
+          [&](const QueryBox<float> &q) { (void)latched.count(q); });
+      std::printf("%7zu  %5.0f%%  %10.0f  %12.0f  %7.0f\n", threads,
+                  writes * 100, plainRate / 1e3, lockedRate / 1e3,
+                  latchedRate / 1e3);
+    }
+  }
+  return 0;
+}
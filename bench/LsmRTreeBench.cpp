@@ -0,0 +1,109 @@
+#include "Bench.h"
+#include "LsmRTree.h"
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+// Ingest throughput and query latency of LsmRTree against a plain RTree.
+// Usage: LsmRTreeBench [points]
+
+namespace {
+constexpr float RANGE = 10000;
+
+template <typename Tree>
+auto queryLatencies(const Tree &tree, const std::vector<QueryBox<float>> &qs)
+    -> std::vector<double> {
+  std::vector<double> latencies;
+  for (const auto &q : qs) {
+    auto start = Clock::now();
+    auto found = tree.query(q);
+    latencies.push_back(microsSince(start));
+    (void)found;
+  }
+  return latencies;
+}
+
+template <typename Tree>
+auto knnMicros(const Tree &tree, const std::vector<Point<float>> &centers)
+    -> double {
+  auto start = Clock::now();
+  for (const auto &center : centers) {
+    (void)tree.knn(center, 10);
+  }
+  return microsSince(start) / static_cast<double>(centers.size());
+}
+
+void report(const char *what, const std::vector<double> &latencies) {
+  std::printf("  %-28s p50 %8.1f us  p99 %8.1f us\n", what,
+              percentile(latencies, 0.5), percentile(latencies, 0.99));
+}
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+  size_t n = argumentOr(argc, argv, 1, 500000);
+  auto points = uniformPoints(n, RANGE, 1);
+  auto queries = squareQueries(2000, RANGE, 100, 2);
+  std::vector<Point<float>> centers(points.begin(),
+                                    points.begin() + std::min<size_t>(n, 2000));
+
+  {
+    // RTree::query() is not const
+    RTree<float> tree(4, 16);
+    auto start = Clock::now();
+    for (const auto &point : points) {
+      tree.insert(point);
+    }
+    double insert = microsSince(start);
+    std::vector<double> latencies;
+    for (const auto &q : queries) {
+      auto begin = Clock::now();
+      auto found = tree.query(q);
+      latencies.push_back(microsSince(begin));
+      (void)found;
+    }
+    std::printf("RTree, %zu points\n", n);
+    std::printf("  insert %.2f us/op\n", insert / static_cast<double>(n));
+    report("query", latencies);
+    std::printf("  knn, k = 10 %.1f us\n", knnMicros(tree, centers));
+  }
+
+  {
+    LsmRTree<float> tree;
+    auto start = Clock::now();
+    for (const auto &point : points) {
+      tree.insert(point);
+    }
+    double insert = microsSince(start);
+    auto early = queryLatencies(tree, queries);
+    size_t earlyRuns = tree.runCount();
+    tree.flush();
+    double flushed = microsSince(start);
+    auto idle = queryLatencies(tree, queries);
+    std::printf("LsmRTree, %zu points\n", n);
+    std::printf("  insert %.2f us/op, with flush %.2f us/op\n",
+                insert / static_cast<double>(n),
+                flushed / static_cast<double>(n));
+    report("query right after ingest", early);
+    std::printf("  (%zu runs, %zu after flush)\n", earlyRuns,
+                tree.runCount());
+    report("query after flush", idle);
+    std::printf("  knn, k = 10 %.1f us\n", knnMicros(tree, centers));
+
+    // Readers while a second batch is ingested
+    std::atomic<bool> done{false};
+    std::thread writer([&tree, &done, n] {
+      for (const auto &point : uniformPoints(n, RANGE, 3)) {
+        tree.insert(point);
+      }
+      done = true;
+    });
+    std::vector<double> busy;
+    while (!done) {
+      auto latencies = queryLatencies(tree, queries);
+      busy.insert(busy.end(), latencies.begin(), latencies.end());
+    }
+    writer.join();
+    report("query during ingest", busy);
+  }
+  return 0;
+}
@@ -0,0 +1,60 @@
+#include "Bench.h"
+#include "Rtree.h"
+#include <cstdio>
+
+// Moving objects: every point moves up to one unit per step on a bulk
+// loaded tree, either by remove() + insert() or by update() with several
+// tolerances. Count queries afterwards show how well each keeps the tree's
+// shape.
+// Usage: MovingObjectsBench [points] [steps]
+
+namespace {
+constexpr float RANGE = 10000;
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+  size_t n = argumentOr(argc, argv, 1, 200000);
+  size_t steps = argumentOr(argc, argv, 2, 5);
+  auto queries = squareQueries(20000, RANGE, 50, 9);
+  std::printf("%zu points, %zu steps\n", n, steps);
+
+  // Negative tolerance stands for remove() + insert()
+  for (float tolerance : {-1.0F, 0.0F, 1.0F, 5.0F}) {
+    auto points = uniformPoints(n, RANGE, 5);
+    auto tree = RTree<float>::bulkLoad(points, 4, 16);
+    std::mt19937 rng(6);
+    std::uniform_real_distribution<float> velocity(-1.0F, 1.0F);
+
+    auto start = Clock::now();
+    for (size_t step = 0; step < steps; ++step) {
+      for (auto &point : points) {
+        Point<float> to(point.getX().getValue() + velocity(rng),
+                        point.getY().getValue() + velocity(rng));
+        if (tolerance < 0) {
+          tree.remove(point);
+          tree.insert(to);
+        } else {
+          (void)tree.update(point, to, tolerance);
+        }
+        point = to;
+      }
+    }
+    double move = microsSince(start) / static_cast<double>(n * steps);
+
+    start = Clock::now();
+    size_t found = 0;
+    for (const auto &q : queries) {
+      found += tree.count(q);
+    }
+    double count = microsSince(start) / static_cast<double>(queries.size());
+
+    if (tolerance < 0) {
+      std::printf("remove+insert  ");
+    } else {
+      std::printf("update tol %-3.0f ", static_cast<double>(tolerance));
+    }
+    std::printf("%6.2f us/move, then count %6.2f us (%zu found)\n", move,
+                count, found);
+  }
+  return 0;
+}
@@ -0,0 +1,46 @@
+#include "Bench.h"
+#include "Rtree.h"
+#include <cstdio>
+
+// RTree::searchBatch() against a loop of search() calls on a bulk loaded
+// tree. Half of the lookups hit a stored point. The gain depends on the
+// tree being larger than the caches, so try several sizes.
+// Usage: SearchBatchBench [points] [lookups]
+
+namespace {
+constexpr float RANGE = 1e6F;
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+  size_t n = argumentOr(argc, argv, 1, 4000000);
+  size_t m = argumentOr(argc, argv, 2, 1000000);
+  auto points = uniformPoints(n, RANGE, 1);
+  auto tree = RTree<float>::bulkLoad(points, 4, 16);
+
+  auto misses = uniformPoints(m, RANGE, 2);
+  std::mt19937 rng(3);
+  std::vector<Point<float>> lookups;
+  for (size_t i = 0; i < m; ++i) {
+    lookups.push_back(i % 2 == 0 ? points[rng() % n] : misses[i]);
+  }
+  std::printf("%zu points, %.0f MB, %zu lookups\n", n,
+              static_cast<double>(tree.memoryUsage()) / 1e6, m);
+
+  auto start = Clock::now();
+  size_t hits = 0;
+  for (const auto &point : lookups) {
+    hits += tree.search(point) ? 1 : 0;
+  }
+  double loop = microsSince(start);
+  std::printf("search() loop   %6.0f ns/lookup  (%zu hits)\n",
+              loop * 1e3 / static_cast<double>(m), hits);
+
+  for (size_t inFlight : {1, 4, 8, 16, 32, 64}) {
+    start = Clock::now();
+    auto found = tree.searchBatch(lookups, inFlight);
+    double batch = microsSince(start);
+    std::printf("batch of %2zu     %6.0f ns/lookup  %.2fx\n", inFlight,
+                batch * 1e3 / static_cast<double>(m), loop / batch);
+  }
+  return 0;
+}
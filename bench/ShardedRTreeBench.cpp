@@ -0,0 +1,64 @@
+#include "Bench.h"
+#include "ShardedRTree.h"
+#include <cstdio>
+#include <thread>
+
+// Write throughput of ShardedRTree for several shard and producer counts,
+// against inserting into one RTree. Times include flush(). Scaling across
+// cores shows only when the host has more cores than producers.
+// Usage: ShardedRTreeBench [points]
+
+namespace {
+constexpr float RANGE = 10000;
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+  size_t n = argumentOr(argc, argv, 1, 400000);
+  auto points = uniformPoints(n, RANGE, 1);
+  std::printf("%u hardware threads, %zu points\n",
+              std::thread::hardware_concurrency(), n);
+
+  {
+    RTree<float> tree(4, 16);
+    auto start = Clock::now();
+    for (const auto &point : points) {
+      tree.insert(point);
+    }
+    std::printf("RTree::insert %.0f k/s\n",
+                static_cast<double>(n) / microsSince(start) * 1e3);
+  }
+
+  std::vector<Point<float>> sample(points.begin(),
+                                   points.begin() + std::min<size_t>(n, 4096));
+  auto queries = squareQueries(200, RANGE, 100, 2);
+  std::printf("shards  producers  inserts      query\n");
+  for (size_t shards : {1, 2, 4, 8, 16}) {
+    for (size_t producers : {1, 2, 4}) {
+      ShardedRTree<float> tree(
+          SpatialPartition<float>::quantiles(sample, shards));
+      auto start = Clock::now();
+      std::vector<std::thread> threads;
+      for (size_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&tree, &points, p, producers] {
+          for (size_t i = p; i < points.size(); i += producers) {
+            tree.insert(points[i]);
+          }
+        });
+      }
+      for (auto &thread : threads) {
+        thread.join();
+      }
+      tree.flush();
+      double inserts = static_cast<double>(n) / microsSince(start) * 1e3;
+
+      auto begin = Clock::now();
+      for (const auto &q : queries) {
+        (void)tree.query(q);
+      }
+      double query = microsSince(begin) / static_cast<double>(queries.size());
+      std::printf("%6zu  %9zu  %6.0f k/s  %6.1f us\n", shards, producers,
+                  inserts, query);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include "Point.h"
+#include <functional>
+
+// User-defined monoid maintained on every node of an aggregate-augmented
+// RTree. `lift` maps a stored point to a value, `combine` must be associative
+// and `identity` its neutral element. Values have the coordinate type
+// Safe<T>, so sums over an integral tree overflow like T does, and the
+// value can only be derived from the point itself; the tree stores no
+// other data per point.
+template <Coordinate T = float> struct Monoid {
+  std::function<Safe<T>(const Point<T> &)> lift;
+  std::function<Safe<T>(const Safe<T> &, const Safe<T> &)> combine;
+  Safe<T> identity;
+};
+
+#endif // AGGREGATE_H
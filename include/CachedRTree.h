@@ -0,0 +1,103 @@
+#ifndef CACHED_RTREE_H
+#define CACHED_RTREE_H
+
+#include "Rtree.h"
+#include <array>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+template <Coordinate T = float> struct QueryCacheOptions {
+  // Bytes of cached results kept before the least recently used are evicted
+  size_t capacityBytes = size_t{16} << 20U;
+  // Grid the query boxes are rounded out to before caching, so boxes that
+  // differ by less than one cell share an entry. 0 caches boxes as given.
+  T quantum = T{};
+};
+
+struct QueryCacheStats {
+  size_t hits = 0;         // Answered from the entry for the same box
+  size_t supersetHits = 0; // Answered by filtering a cached larger box
+  size_t misses = 0;
+  size_t invalidations = 0; // Entries dropped because a write touched them
+  size_t evictions = 0;     // Entries dropped for space
+  uint64_t hitNanos = 0;    // Time spent in query() on both kinds of hits
+  uint64_t missNanos = 0;   // Time spent in query() on misses
+
+  [[nodiscard]] auto hitRate() const -> double {
+    size_t total = hits + supersetHits + misses;
+    return total == 0 ? 0.0
+                      : static_cast<double>(hits + supersetHits) /
+                            static_cast<double>(total);
+  }
+};
+
+// RTree with an LRU cache of query() results in front of it. Results are
+// cached for the query box rounded out to the quantum grid and filtered to
+// the exact box on the way out; a box with no entry of its own is answered
+// from the smallest cached box containing it. insert(), remove() and
+// update() drop exactly the entries whose box contains a changed point.
+template <Coordinate T = float> class CachedRTree {
+private:
+  using Key = std::array<T, 4>; // low x, low y, high x, high y
+
+  struct KeyHash {
+    auto operator()(const Key &key) const -> size_t;
+  };
+
+  struct Entry {
+    Key key;
+    MBB<T> box;
+    std::vector<Point<T>> points;
+    size_t bytes;
+  };
+
+  RTree<T> tree;
+  QueryCacheOptions<T> options;
+  std::list<Entry> entries; // Most recently used first
+  std::unordered_map<Key, typename std::list<Entry>::iterator, KeyHash> index;
+  size_t cachedBytes;
+  QueryCacheStats counters;
+
+  [[nodiscard]] auto keyOf(const QueryBox<T> &q) const -> Key;
+  void store(const Key &key, std::vector<Point<T>> points);
+  void drop(typename std::list<Entry>::iterator entry);
+  void invalidate(const Point<T> &point);
+
+public:
+  CachedRTree(uint _minChildren, uint _maxChildren,
+              QueryCacheOptions<T> _options = {})
+      : CachedRTree(RTree<T>(_minChildren, _maxChildren), _options) {}
+  explicit CachedRTree(RTree<T> _tree, QueryCacheOptions<T> _options = {})
+      : tree(std::move(_tree)), options(_options), cachedBytes(0) {}
+
+  void insert(const Point<T> &point);
+  void remove(const Point<T> &point);
+  auto update(const Point<T> &from, const Point<T> &to, T tolerance = T{})
+      -> bool;
+  auto query(const QueryBox<T> &q) -> std::vector<Point<T>>;
+  // Drops every cached result
+  void clear();
+
+  auto search(const Point<T> &point) -> bool { return tree.search(point); }
+  [[nodiscard]] auto count(const QueryBox<T> &q) const -> size_t {
+    return tree.count(q);
+  }
+  [[nodiscard]] auto size() const -> size_t { return tree.size(); }
+  [[nodiscard]] auto getTree() const -> const RTree<T> & { return tree; }
+
+  [[nodiscard]] auto stats() const -> const QueryCacheStats & {
+    return counters;
+  }
+  void resetStats() { counters = {}; }
+  [[nodiscard]] auto cacheBytes() const -> size_t { return cachedBytes; }
+  [[nodiscard]] auto cacheEntries() const -> size_t { return entries.size(); }
+};
+
+extern template class CachedRTree<float>;
+extern template class CachedRTree<double>;
+extern template class CachedRTree<int32_t>;
+extern template class CachedRTree<int64_t>;
+
+#endif // CACHED_RTREE_H
@@ -0,0 +1,67 @@
+#ifndef COMPACT_RTREE_H
+#define COMPACT_RTREE_H
+
+#include "Rtree.h"
+#include <array>
+#include <cstdint>
+#include <limits>
+
+// Read-only snapshot of an RTree in a compact layout. Nodes are stored
+// breadth-first in one array and reference their children by index. Every
+// child box is quantized to Q-bit integers relative to its parent's box and
+// rounded outward, so results stay exact and coarser boxes only cost extra
+// node visits. Integral coordinates are quantized to whole cells. Every
+// node keeps its subtree count, so count() skips covered subtrees.
+template <Coordinate T = float, std::unsigned_integral Q = uint16_t>
+class CompactRTree {
+private:
+  struct Node {
+    uint32_t first; // First child node, or first point if it is a leaf
+    uint32_t count; // Points stored below this node
+    uint16_t size;  // Number of children or points
+    bool isLeaf;
+  };
+  using QuantizedBox = std::array<Q, 4>; // low x, low y, high x, high y
+
+  static constexpr Q steps = std::numeric_limits<Q>::max();
+
+  std::vector<Node> nodes;         // Children of a node are adjacent
+  std::vector<QuantizedBox> boxes; // boxes[i] belongs to nodes[i]
+  std::vector<Point<T>> points;    // Points of a leaf are adjacent
+  MBB<T> rootBox;
+
+  template <std::unsigned_integral U> static auto cellSize(U extent) -> U;
+  static auto dequantize(T low, T high, Q q) -> T;
+  static auto quantizeLow(T low, T high, T value) -> Q;
+  static auto quantizeHigh(T low, T high, T value) -> Q;
+  static auto quantize(const MBB<T> &parent, const MBB<T> &box)
+      -> QuantizedBox;
+  static auto dequantize(const MBB<T> &parent, const QuantizedBox &box)
+      -> MBB<T>;
+
+public:
+  explicit CompactRTree(const RTree<T> &tree);
+
+  [[nodiscard]] auto search(const Point<T> &point) const -> bool;
+  [[nodiscard]] auto query(const QueryBox<T> &q) const
+      -> std::vector<Point<T>>;
+  [[nodiscard]] auto count(const QueryBox<T> &q) const -> size_t;
+
+  [[nodiscard]] auto size() const -> size_t { return points.size(); }
+  [[nodiscard]] auto memoryUsage() const -> size_t {
+    return sizeof(*this) + nodes.capacity() * sizeof(Node) +
+           boxes.capacity() * sizeof(QuantizedBox) +
+           points.capacity() * sizeof(Point<T>);
+  }
+};
+
+extern template class CompactRTree<float, uint8_t>;
+extern template class CompactRTree<float, uint16_t>;
+extern template class CompactRTree<double, uint8_t>;
+extern template class CompactRTree<double, uint16_t>;
+extern template class CompactRTree<int32_t, uint8_t>;
+extern template class CompactRTree<int32_t, uint16_t>;
+extern template class CompactRTree<int64_t, uint8_t>;
+extern template class CompactRTree<int64_t, uint16_t>;
+
+#endif // COMPACT_RTREE_H
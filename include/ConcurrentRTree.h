@@ -0,0 +1,91 @@
+#ifndef CONCURRENT_RTREE_H
+#define CONCURRENT_RTREE_H
+
+#include "MBB.h"
+#include <array>
+#include <atomic>
+#include <shared_mutex>
+#include <vector>
+
+// R-link tree: an R-tree that any number of threads may read and write at
+// once, with a latch per node instead of a tree-wide lock.
+//
+// Readers and writers descend holding one latch at a time. To stay correct
+// while a node they are about to enter is being split, every split stamps
+// the node with a fresh value of a global counter (its NSN) and chains the
+// new node to its right. A thread that read the parent before the split
+// sees an NSN newer than the counter value it memorized at the parent and
+// also follows the right link. Splits are posted to the parent while the
+// split node is still latched, and latches are only ever acquired bottom-up
+// (and left to right within a level), so writers cannot deadlock. The root
+// never moves: when it overflows its entries are pushed down into two new
+// children.
+//
+// Nodes are never freed while the tree is alive. remove() takes a point out
+// of its leaf but does not shrink boxes or merge underfull nodes.
+template <Coordinate T = float> class ConcurrentRTree {
+private:
+  struct Node {
+    mutable std::shared_mutex latch;
+    uint32_t level;          // 0 for leaves; only the root's level changes
+    uint64_t nsn = 0;        // Counter value of the latest posted split
+    Node *right = nullptr;   // Next node on the same level
+    std::vector<Point<T>> points; // Only used by leaves
+    std::vector<Node *> children; // Only used by internal nodes
+    std::vector<MBB<T>> boxes;    // boxes[i] covers children[i]
+
+    explicit Node(uint32_t _level) : level(_level) {}
+    [[nodiscard]] auto entries() const -> size_t {
+      return level == 0 ? points.size() : children.size();
+    }
+    [[nodiscard]] auto box() const -> MBB<T>;
+  };
+
+  static constexpr size_t maxLevels = 64;
+
+  Node *root;
+  // First node of every level below the root; each level is one chain of
+  // right links
+  std::array<std::atomic<Node *>, maxLevels> leftmost{};
+  std::atomic<uint64_t> counter;
+  std::atomic<size_t> stored;
+  size_t maxChildren;
+
+  static auto chooseSubtree(const Node &node, const Point<T> &point) -> size_t;
+  static void distribute(Node *from, Node *to);
+  auto split(Node *node) -> Node *;
+  void pushDown();
+  auto lockParent(Node *hint, uint64_t seen, const Node *child,
+                  bool exclusive) -> Node *;
+  template <typename Visit> void walk(const QueryBox<T> &q, Visit visit) const;
+
+public:
+  ConcurrentRTree(uint _minChildren, uint _maxChildren);
+  ~ConcurrentRTree();
+
+  ConcurrentRTree(const ConcurrentRTree &other) = delete;
+  auto operator=(const ConcurrentRTree &other) -> ConcurrentRTree & = delete;
+  ConcurrentRTree(ConcurrentRTree &&other) = delete;
+  auto operator=(ConcurrentRTree &&other) -> ConcurrentRTree & = delete;
+
+  void insert(const Point<T> &point);
+  // Returns whether a copy of `point` was found and removed
+  auto remove(const Point<T> &point) -> bool;
+
+  [[nodiscard]] auto search(const Point<T> &point) const -> bool;
+  [[nodiscard]] auto query(const QueryBox<T> &q) const
+      -> std::vector<Point<T>>;
+  [[nodiscard]] auto count(const QueryBox<T> &q) const -> size_t;
+  [[nodiscard]] auto size() const -> size_t { return stored.load(); }
+  [[nodiscard]] auto height() const -> size_t;
+  // Checks levels, boxes, right-link chains and the point count. Only
+  // meaningful while no other thread uses the tree.
+  [[nodiscard]] auto isValid() const -> bool;
+};
+
+extern template class ConcurrentRTree<float>;
+extern template class ConcurrentRTree<double>;
+extern template class ConcurrentRTree<int32_t>;
+extern template class ConcurrentRTree<int64_t>;
+
+#endif // CONCURRENT_RTREE_H
@@ -2,9 +2,19 @@
 #define INCLUDE_DATATYPE_CPP_
 
 #include <cmath>
+#include <compare>
+#include <concepts>
+#include <cstdint>
+#include <limits>
 #include <stdexcept>
+#include <type_traits>
 
-template <std::floating_point T> class Safe {
+// Coordinate types supported by the tree. Floating point values compare
+// with an epsilon, integral values compare exactly.
+template <typename T>
+concept Coordinate = std::floating_point<T> || std::signed_integral<T>;
+
+template <Coordinate T> class Safe {
 
 private:
   T value;
@@ -14,13 +24,21 @@ public:
   // NOLINTNEXTLINE (hicpp-explicit-constructor)
   Safe(T _value) : value(_value) {}
 
+  static auto equal(T a, T b) -> bool {
+    if constexpr (std::floating_point<T>) {
+      return std::abs(a - b) < std::numeric_limits<T>::epsilon();
+    } else {
+      return a == b;
+    }
+  }
+
   // Comparison operators using <=> and == defaulting
   auto operator==(const Safe &other) const -> bool {
-    return std::abs(value - other.value) < std::numeric_limits<T>::epsilon();
+    return equal(value, other.value);
   }
 
   auto operator<=>(const Safe &other) const {
-    if (std::abs(value - other.value) < std::numeric_limits<T>::epsilon()) {
+    if (equal(value, other.value)) {
       return std::strong_ordering::equal;
     }
     if (value < other.value) {
@@ -30,28 +48,34 @@ public:
   }
 
   auto operator==(const T &scalar) const -> bool {
-    return std::abs(value - scalar) < std::numeric_limits<T>::epsilon();
+    return equal(value, scalar);
   }
 
   bool operator!=(const T &scalar) const { return !(*this == scalar); }
 
   // Arithmetic operators
-  Safe operator+(const Safe &other) const { return Safe(value + other.value); }
-  Safe operator-(const Safe &other) const { return Safe(value - other.value); }
-  Safe operator*(const Safe &other) const { return Safe(value * other.value); }
+  Safe operator+(const Safe &other) const {
+    return Safe(static_cast<T>(value + other.value));
+  }
+  Safe operator-(const Safe &other) const {
+    return Safe(static_cast<T>(value - other.value));
+  }
+  Safe operator*(const Safe &other) const {
+    return Safe(static_cast<T>(value * other.value));
+  }
   Safe operator/(const Safe &other) const {
-    if (std::abs(other.value) < std::numeric_limits<T>::epsilon()) {
+    if (equal(other.value, 0)) {
       throw std::runtime_error("Division by zero");
     }
-    return Safe(value / other.value);
+    return Safe(static_cast<T>(value / other.value));
   }
-  Safe operator-() const { return Safe(-value); }
+  Safe operator-() const { return Safe(static_cast<T>(-value)); }
   Safe &operator+=(const Safe &other) {
-    value += other.value;
+    value = static_cast<T>(value + other.value);
     return *this;
   }
   Safe &operator-=(const Safe &other) {
-    value -= other.value;
+    value = static_cast<T>(value - other.value);
     return *this;
   }
 
@@ -60,13 +84,16 @@ public:
   void setValue(T _value) { value = _value; }
 
   // Mathematical functions
-  static Safe abs(const Safe &other) { return Safe(std::abs(other.value)); }
+  static Safe abs(const Safe &other) {
+    return Safe(static_cast<T>(std::abs(other.value)));
+  }
+  // Integral values return the truncated root
   static Safe sqrt(const Safe &other) {
     if (other.value < 0) {
       throw std::runtime_error(
           "Attempt to calculate the square root of a negative number");
     }
-    return Safe(std::sqrt(other.value));
+    return Safe(static_cast<T>(std::sqrt(other.value)));
   }
   static Safe pow(const Safe &base, int exponent) {
     return Safe(static_cast<T>(std::pow(base.value, exponent)));
@@ -81,25 +108,36 @@ public:
   }
 };
 
-template <std::floating_point T> Safe<T> abs(const Safe<T> &x) {
+template <Coordinate T> Safe<T> abs(const Safe<T> &x) {
   return Safe<T>::abs(x);
 }
-template <std::floating_point T> Safe<T> sqrt(const Safe<T> &x) {
+template <Coordinate T> Safe<T> sqrt(const Safe<T> &x) {
   return Safe<T>::sqrt(x);
 }
-template <std::floating_point T>
+template <Coordinate T>
 Safe<T> pow(const Safe<T> &base, int exponent) {
   return Safe<T>::pow(base, exponent);
 }
-template <std::floating_point T>
+template <Coordinate T>
 Safe<T> min(const Safe<T> &a, const Safe<T> &b) {
   return Safe<T>::min(a, b);
 }
-template <std::floating_point T>
+template <Coordinate T>
 Safe<T> max(const Safe<T> &a, const Safe<T> &b) {
   return Safe<T>::max(a, b);
 }
 
+// Type used for areas and perimeters. Integral coordinates get a wider
+// integer so their areas never go through floating point; 64-bit
+// coordinates fall back to double.
+template <Coordinate T> struct AreaOf {
+  using type = T;
+};
+template <std::signed_integral T> struct AreaOf<T> {
+  using type = std::conditional_t<(sizeof(T) <= 4), std::int64_t, double>;
+};
+template <Coordinate T> using AreaType = Safe<typename AreaOf<T>::type>;
+
 using NType = Safe<float>;
 
 #endif // INCLUDE_DATATYPE_CPP_
@@ -0,0 +1,45 @@
+#ifndef FLATTEN_H
+#define FLATTEN_H
+
+#include "Rtree.h"
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+// Breadth-first numbering shared by the flat tree layouts, so the children
+// of every node get adjacent numbers. Appends the points of every leaf to
+// `points` in the same order and then calls, for each node in turn,
+//   visit(node, parent, first, size)
+// with the number of its parent (0 for the root) and its children's
+// numbers [first, first + size), or for a leaf the range of its points.
+template <Coordinate T, typename Visit>
+void flattenBreadthFirst(const RTree<T> &tree, std::vector<Point<T>> &points,
+                         Visit visit) {
+  std::vector<const RNode<T> *> order = {tree.getRoot()};
+  std::vector<uint32_t> parents = {0};
+  points.reserve(points.size() + tree.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    const RNode<T> *node = order[i];
+    size_t first = 0;
+    size_t size = 0;
+    if (node->isLeaf) {
+      auto entries = node->getPoints();
+      first = points.size();
+      size = entries.size();
+      points.insert(points.end(), entries.begin(), entries.end());
+    } else {
+      auto entries = node->getChildren();
+      first = order.size();
+      size = entries.size();
+      order.insert(order.end(), entries.begin(), entries.end());
+      parents.insert(parents.end(), size, static_cast<uint32_t>(i));
+    }
+    if (first + size > std::numeric_limits<uint32_t>::max()) {
+      throw std::runtime_error("RTree is too large to flatten");
+    }
+    visit(*node, parents[i], static_cast<uint32_t>(first), size);
+  }
+}
+
+#endif // FLATTEN_H
@@ -0,0 +1,51 @@
+#ifndef FROZEN_RTREE_H
+#define FROZEN_RTREE_H
+
+#include "MBB.h"
+#include <cstdint>
+#include <vector>
+
+template <Coordinate T> class RTree;
+
+// Immutable copy of an RTree, see RTree::freeze(). Nodes are stored
+// breadth-first in one array, one 64-byte line each, so the children of a
+// node are adjacent and are reached by index. Points of a leaf are adjacent
+// in a second array. Every node keeps its subtree count, so count() skips
+// covered subtrees like the live tree does.
+template <Coordinate T = float> class FrozenRTree {
+private:
+  struct alignas(64) Node {
+    MBB<T> box;
+    uint64_t count; // Points stored below this node
+    uint32_t first; // First child node, or first point if it is a leaf
+    uint32_t size;  // Number of children or points
+    bool isLeaf;
+  };
+
+  std::vector<Node> nodes;
+  std::vector<Point<T>> points;
+
+public:
+  explicit FrozenRTree(const RTree<T> &tree);
+
+  [[nodiscard]] auto search(const Point<T> &point) const -> bool;
+  [[nodiscard]] auto query(const QueryBox<T> &q) const
+      -> std::vector<Point<T>>;
+  [[nodiscard]] auto count(const QueryBox<T> &q) const -> size_t;
+  // The k stored points closest to `point`, nearest first
+  [[nodiscard]] auto knn(const Point<T> &point, size_t k) const
+      -> std::vector<Point<T>>;
+
+  [[nodiscard]] auto size() const -> size_t { return points.size(); }
+  [[nodiscard]] auto memoryUsage() const -> size_t {
+    return sizeof(*this) + nodes.capacity() * sizeof(Node) +
+           points.capacity() * sizeof(Point<T>);
+  }
+};
+
+extern template class FrozenRTree<float>;
+extern template class FrozenRTree<double>;
+extern template class FrozenRTree<int32_t>;
+extern template class FrozenRTree<int64_t>;
+
+#endif // FROZEN_RTREE_H
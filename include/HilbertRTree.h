@@ -0,0 +1,88 @@
+#ifndef HILBERT_RTREE_H
+#define HILBERT_RTREE_H
+
+#include "MBB.h"
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Hilbert R-tree. Every point is keyed by its position on a Hilbert curve
+// over `domain` (points outside it are clamped to the border), leaves keep
+// their points sorted by key and every node records the largest key below
+// it (its LHV). Inserts descend by key alone, without area computations, so
+// the tree comes out the same whatever the insertion order.
+//
+// Overflow is deferred: a full node first shares its entries with a sibling
+// and only when both are full are the two split into three, which keeps
+// nodes about two thirds full or more. Underfull nodes borrow from or merge
+// with a sibling in the same way.
+template <Coordinate T = float> class HilbertRTree {
+private:
+  struct Entry {
+    uint64_t key;
+    Point<T> point;
+  };
+
+  struct Node {
+    MBB<T> box;
+    uint64_t lhv = 0; // Largest key stored below this node
+    bool isLeaf;
+    std::vector<Entry> entries;  // Only used by leaves, sorted by key
+    std::vector<Node *> children; // Only used by internal nodes, by LHV
+
+    explicit Node(bool _isLeaf) : isLeaf(_isLeaf) {}
+    [[nodiscard]] auto size() const -> size_t {
+      return isLeaf ? entries.size() : children.size();
+    }
+  };
+
+  // Nodes from the root down to the current one, with the index of the
+  // child taken at each of them
+  using Path = std::vector<std::pair<Node *, size_t>>;
+
+  MBB<T> domain;
+  Node *root;
+  size_t minChildren;
+  size_t maxChildren;
+  size_t stored;
+
+  [[nodiscard]] auto keyOf(const Point<T> &point) const -> uint64_t;
+  static auto refresh(Node *node) -> bool;
+  static void spread(const std::vector<Node *> &group);
+  auto findLeaf(const Point<T> &point, uint64_t key, Path &path) const
+      -> Node *;
+  void handleOverflow(Node *node, Path &path);
+  void handleUnderflow(Node *node, Path &path);
+
+public:
+  HilbertRTree(const MBB<T> &_domain, uint _minChildren, uint _maxChildren);
+  ~HilbertRTree();
+
+  HilbertRTree(const HilbertRTree &other) = delete;
+  auto operator=(const HilbertRTree &other) -> HilbertRTree & = delete;
+  HilbertRTree(HilbertRTree &&other) = delete;
+  auto operator=(HilbertRTree &&other) -> HilbertRTree & = delete;
+
+  void insert(const Point<T> &point);
+  // Returns whether a copy of `point` was found and removed
+  auto remove(const Point<T> &point) -> bool;
+
+  [[nodiscard]] auto search(const Point<T> &point) const -> bool;
+  [[nodiscard]] auto query(const QueryBox<T> &q) const
+      -> std::vector<Point<T>>;
+  [[nodiscard]] auto count(const QueryBox<T> &q) const -> size_t;
+  [[nodiscard]] auto size() const -> size_t { return stored; }
+  [[nodiscard]] auto height() const -> size_t;
+  [[nodiscard]] auto nodeCount() const -> size_t;
+  [[nodiscard]] auto memoryUsage() const -> size_t;
+  // Checks fill bounds, key order, LHVs, boxes, leaf depth and the point
+  // count
+  [[nodiscard]] auto isValid() const -> bool;
+};
+
+extern template class HilbertRTree<float>;
+extern template class HilbertRTree<double>;
+extern template class HilbertRTree<int32_t>;
+extern template class HilbertRTree<int64_t>;
+
+#endif // HILBERT_RTREE_H
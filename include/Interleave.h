@@ -0,0 +1,63 @@
+#ifndef INTERLEAVE_H
+#define INTERLEAVE_H
+
+#include <coroutine>
+#include <utility>
+#include <vector>
+
+// Coroutine that runs from one co_await to the next each time it is
+// resumed. Independent lookups written this way prefetch the memory they
+// need next and suspend, so interleave() can overlap the cache misses of
+// many of them on one thread.
+class Interleaved {
+public:
+  struct promise_type {
+    auto get_return_object() -> Interleaved {
+      return Interleaved(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    auto initial_suspend() noexcept -> std::suspend_always { return {}; }
+    auto final_suspend() noexcept -> std::suspend_always { return {}; }
+    void return_void() {}
+    void unhandled_exception() { throw; }
+  };
+
+  explicit Interleaved(std::coroutine_handle<promise_type> _handle)
+      : handle(_handle) {}
+  ~Interleaved() {
+    if (handle) {
+      handle.destroy();
+    }
+  }
+
+  Interleaved(const Interleaved &other) = delete;
+  auto operator=(const Interleaved &other) -> Interleaved & = delete;
+  Interleaved(Interleaved &&other) noexcept
+      : handle(std::exchange(other.handle, {})) {}
+  auto operator=(Interleaved &&other) noexcept -> Interleaved & {
+    std::swap(handle, other.handle);
+    return *this;
+  }
+
+  [[nodiscard]] auto done() const -> bool { return handle.done(); }
+  void resume() const { handle.resume(); }
+
+private:
+  std::coroutine_handle<promise_type> handle;
+};
+
+// Resumes the tasks round-robin until every one of them has finished
+inline void interleave(std::vector<Interleaved> &tasks) {
+  size_t running = tasks.size();
+  while (running > 0) {
+    running = 0;
+    for (auto &task : tasks) {
+      if (!task.done()) {
+        task.resume();
+        running += task.done() ? 0 : 1;
+      }
+    }
+  }
+}
+
+#endif // INTERLEAVE_H
@@ -0,0 +1,105 @@
+#ifndef LSM_RTREE_H
+#define LSM_RTREE_H
+
+#include "Rtree.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+struct LsmOptions {
+  // Writes collected in the mutable buffer before it is frozen into a run
+  size_t bufferCapacity = 8192;
+  // Writers stall while this many frozen buffers still wait to be packed
+  size_t maxFrozenRuns = 4;
+  // Adjacent runs are merged while the older one holds at most this many
+  // times the entries of the newer one
+  size_t mergeRatio = 2;
+  // Fan-out of the packed run trees
+  uint minChildren = 4;
+  uint maxChildren = 16;
+};
+
+// Log-structured spatial index for write-heavy workloads.
+//
+// insert() and remove() only append to a small mutable buffer. A full
+// buffer is frozen and handed to a background thread, which bulk loads it
+// into an immutable RTree run and merges runs of similar size, so the number
+// of runs stays logarithmic. remove() records a tombstone that cancels one
+// copy of the point in an older run; merges apply tombstones and drop them
+// once nothing older is left. Readers scan the buffer under a shared lock
+// and the runs from a snapshot, so merges never block them.
+template <Coordinate T = float> class LsmRTree {
+private:
+  struct Run {
+    std::vector<Point<T>> points;     // Only until the run is packed
+    std::optional<RTree<T>> tree;     // Set once the run is packed
+    std::vector<Point<T>> tombstones; // Each cancels a copy in an older run
+    size_t entries = 0;               // Points stored in the run
+
+    [[nodiscard]] auto packed() const -> bool { return tree.has_value(); }
+  };
+  using RunPtr = std::shared_ptr<const Run>;
+
+  LsmOptions options;
+  mutable std::shared_mutex mutex;
+  std::condition_variable_any changed;
+  std::vector<Point<T>> buffer;
+  std::vector<Point<T>> bufferTombstones;
+  std::vector<RunPtr> runs; // Newest first
+  bool stopping;
+  std::thread compactor;
+
+  void freeze(std::unique_lock<std::shared_mutex> &lock);
+  [[nodiscard]] auto hasWork() const -> bool;
+  void compactLoop();
+  auto pack(const Run &run) const -> RunPtr;
+  auto merge(const Run &newer, const Run &older, bool oldest) const -> RunPtr;
+  [[nodiscard]] auto liveCopies(const Point<T> &point) const -> size_t;
+  // Copies the buffered entries inside `q` (all of them if null) and
+  // returns the runs to read next
+  auto snapshot(const QueryBox<T> *q, std::vector<Point<T>> &points,
+                std::vector<Point<T>> &tombstones) const
+      -> std::vector<RunPtr>;
+
+  static void runQuery(const Run &run, const QueryBox<T> &q,
+                       std::vector<Point<T>> &out);
+  // Drops one copy from `points` per tombstone, returning the tombstones
+  // that matched nothing
+  static auto cancel(std::vector<Point<T>> &points,
+                     std::vector<Point<T>> tombstones)
+      -> std::vector<Point<T>>;
+
+public:
+  explicit LsmRTree(LsmOptions _options = {});
+  ~LsmRTree();
+
+  LsmRTree(const LsmRTree &other) = delete;
+  auto operator=(const LsmRTree &other) -> LsmRTree & = delete;
+  LsmRTree(LsmRTree &&other) = delete;
+  auto operator=(LsmRTree &&other) -> LsmRTree & = delete;
+
+  void insert(const Point<T> &point);
+  void remove(const Point<T> &point);
+  // Freezes the buffer and waits until every run is packed and merged
+  void flush();
+
+  [[nodiscard]] auto search(const Point<T> &point) const -> bool;
+  [[nodiscard]] auto query(const QueryBox<T> &q) const
+      -> std::vector<Point<T>>;
+  [[nodiscard]] auto count(const QueryBox<T> &q) const -> size_t;
+  [[nodiscard]] auto knn(const Point<T> &point, size_t k) const
+      -> std::vector<Point<T>>;
+  [[nodiscard]] auto size() const -> size_t;
+  [[nodiscard]] auto runCount() const -> size_t;
+};
+
+extern template class LsmRTree<float>;
+extern template class LsmRTree<double>;
+extern template class LsmRTree<int32_t>;
+extern template class LsmRTree<int64_t>;
+
+#endif // LSM_RTREE_H
@@ -3,7 +3,7 @@
 
 #include "Point.h"
 
-template <std::floating_point T = float> class MBB {
+template <Coordinate T = float> class MBB {
 public:
   Point<T> lowerLeft;
   Point<T> upperRight;
@@ -14,15 +14,18 @@ public:
       : lowerLeft(_lowerLeft), upperRight(_upperRight) {}
 
   [[nodiscard]] auto intersects(const MBB &other) const -> bool;
-  [[nodiscard]] auto intersectionArea(const MBB &other) const -> NType;
+  [[nodiscard]] auto intersectionArea(const MBB &other) const -> AreaType<T>;
   void expand(const MBB &other);
-  [[nodiscard]] auto calculateExpansionCost(const MBB &other) const -> NType;
+  [[nodiscard]] auto calculateExpansionCost(const MBB &other) const -> AreaType<T>;
   [[nodiscard]] auto contains(const Point<T> &point) const -> bool;
-  [[nodiscard]] auto perimeter() const -> NType;
-  [[nodiscard]] auto area() const -> NType;
+  [[nodiscard]] auto contains(const MBB &other) const -> bool;
+  [[nodiscard]] auto perimeter() const -> AreaType<T>;
+  [[nodiscard]] auto area() const -> AreaType<T>;
+  // Squared distance from `point` to the closest point of the box, 0 inside
+  [[nodiscard]] auto distanceSquared(const Point<T> &point) const -> double;
 };
 
-template <std::floating_point T = float> class QueryBox {
+template <Coordinate T = float> class QueryBox {
 private:
   MBB<T> mbb;
 
@@ -36,9 +39,15 @@ public:
   auto contains(const Point<T> &point) const -> bool {
     return mbb.contains(point);
   }
+  auto contains(const MBB<T> &other) const -> bool {
+    return mbb.contains(other);
+  }
   auto getMBB() const -> const MBB<T> & { return mbb; }
 };
 
 extern template class MBB<float>;
+extern template class MBB<double>;
+extern template class MBB<int32_t>;
+extern template class MBB<int64_t>;
 
 #endif // MBB_H
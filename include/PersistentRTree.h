@@ -0,0 +1,94 @@
+#ifndef PERSISTENT_RTREE_H
+#define PERSISTENT_RTREE_H
+
+#include "Rtree.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct PersistenceOptions {
+  // Write-ahead log records buffered before one write + fsync
+  size_t groupCommitSize = 4096;
+  // Age of the oldest buffered record that forces a group commit. It is
+  // only checked when the next operation is logged; there is no background
+  // flush, so call sync() to bound the delay after the last write.
+  std::chrono::milliseconds groupCommitInterval{10};
+  // Operations between automatic checkpoints, 0 to only checkpoint manually
+  size_t checkpointInterval = 1U << 20U;
+  // Rewrite the checkpoint file once it grows past this multiple of its size
+  // after the last full rewrite
+  size_t compactionRatio = 4;
+};
+
+// RTree backed by a directory holding a write-ahead log and a checkpoint file.
+//
+// insert() and remove() are appended to the log and become durable at the
+// next group commit (sync()). A checkpoint appends only the nodes changed
+// since the previous one, followed by a commit record, and then empties the
+// log. Recovery loads the last committed checkpoint and replays the log
+// records past it; torn records at the end of either file are discarded.
+// Uses POSIX file APIs.
+template <Coordinate T = float> class PersistentRTree {
+private:
+  RTree<T> tree;
+  PersistenceOptions options;
+  std::string walPath;
+  std::string checkpointPath;
+  int walFd;
+  int checkpointFd;
+
+  std::vector<std::byte> walBuffer;
+  size_t bufferedRecords;
+  std::chrono::steady_clock::time_point lastSync;
+
+  uint64_t lsn;            // Sequence number of the last logged operation
+  uint64_t checkpointLsn;  // Last operation covered by the checkpoint file
+  uint64_t nextNodeId;     // Next id handed to a node record
+  size_t checkpointSize;   // Current checkpoint file size
+  size_t compactedSize;    // Checkpoint file size after the last full rewrite
+  size_t opsSinceCheckpoint;
+
+  void log(uint8_t op, const Point<T> &point);
+  void recover();
+  void loadCheckpoint();
+  void replayLog();
+  void writeNodes(int fd, bool everything, size_t &written);
+  // Marks every node as not yet written to the checkpoint file
+  void forgetDiskIds();
+  void compact();
+
+public:
+  PersistentRTree(const std::string &directory, uint minChildren,
+                  uint maxChildren, PersistenceOptions _options = {});
+  ~PersistentRTree();
+
+  PersistentRTree(const PersistentRTree &other) = delete;
+  auto operator=(const PersistentRTree &other) -> PersistentRTree & = delete;
+  PersistentRTree(PersistentRTree &&other) = delete;
+  auto operator=(PersistentRTree &&other) -> PersistentRTree & = delete;
+
+  void insert(const Point<T> &point);
+  void remove(const Point<T> &point);
+  // Group commit: makes every operation logged so far durable
+  void sync();
+  void checkpoint();
+
+  auto search(const Point<T> &point) -> bool { return tree.search(point); }
+  auto query(const QueryBox<T> &q) -> std::vector<Point<T>> {
+    return tree.query(q);
+  }
+  [[nodiscard]] auto count(const QueryBox<T> &q) const -> size_t {
+    return tree.count(q);
+  }
+  [[nodiscard]] auto size() const -> size_t { return tree.size(); }
+  [[nodiscard]] auto getTree() const -> const RTree<T> & { return tree; }
+};
+
+extern template class PersistentRTree<float>;
+extern template class PersistentRTree<double>;
+extern template class PersistentRTree<int32_t>;
+extern template class PersistentRTree<int64_t>;
+
+#endif // PERSISTENT_RTREE_H
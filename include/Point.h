@@ -4,7 +4,7 @@
 #include "DataType.h"
 #include <iostream>
 
-template <std::floating_point T = float> class Point {
+template <Coordinate T = float> class Point {
 private:
   using NType = Safe<T>;
 
@@ -1,58 +1,108 @@
 #ifndef RTREE_H
 #define RTREE_H
 
+#include "Aggregate.h"
+#include "FrozenRTree.h"
+#include "Interleave.h"
 #include "MBB.h"
+#include <atomic>
+#include <memory>
 #include <optional>
 #include <vector>
 
-template <std::floating_point T> class RTree;
+template <Coordinate T> class RTree;
+template <Coordinate T> class PersistentRTree;
 
-template <std::floating_point T = float> class RNode {
+// Settings shared by all nodes of one RTree. They are passed down by the
+// tree instead of being repeated in every node.
+template <Coordinate T = float> struct TreeParams {
+  size_t minChildren;
+  size_t maxChildren;
+  const Monoid<T> *monoid; // Only set for aggregate-augmented trees
+};
+
+template <Coordinate T = float> class RNode {
 private:
   MBB<T> boundingBox;
   std::vector<Point<T>> points;  // Only used if it is a leaf node
   std::vector<RNode *> children; // Only used if it is not a leaf node
   RNode *parent;
-  size_t minChildren;
-  size_t maxChildren;
+  size_t subtreeCount;           // Points stored below this node
+  Safe<T> subtreeAggregate;      // Only maintained if the tree has a monoid
+
+  // Nodes allocated together by RTree::clone(); freed with the last of them
+  struct Block {
+    std::atomic<size_t> live;
+  };
+
+  // Number of parents (or RTree roots) referencing this node. Nodes with
+  // more than one reference are shared copy-on-write and never modified.
+  mutable std::atomic<uint32_t> refs;
+  Block *block; // Only set if the node lives inside a clone() block
+
+  // Id of the node's latest checkpoint record. Reset to 0 whenever the node
+  // changes, so a checkpoint only descends into nodes with id 0.
+  uint64_t diskId;
+
   ~RNode();
-  // copy,copy assignment, move, move assignment
-  // RNode(const RNode &other);
-  // auto operator=(const RNode &other) -> RNode &;
-  // RNode(RNode &&other) noexcept;
-  // auto operator=(RNode &&other) noexcept -> RNode &;
+  // Nodes are shared by pointer, see shallowCopy() and cloneTree()
+  RNode(const RNode &other) = delete;
+  auto operator=(const RNode &other) -> RNode & = delete;
+  RNode(RNode &&other) noexcept = delete;
+  auto operator=(RNode &&other) noexcept -> RNode & = delete;
+
+  static void destroy(RNode *node);
+  static void release(RNode *node);
+  static auto cloneTree(const RNode *root) -> RNode *;
+  auto shallowCopy() const -> RNode *;
+  auto exclusiveChild(RNode *child) -> RNode *;
 
   auto chooseSubtree(const Point<T> &point) -> RNode *;
-  auto split() -> std::pair<RNode<T> *, RNode<T> *>;
+  auto split(const TreeParams<T> &params) -> std::pair<RNode<T> *, RNode<T> *>;
   auto pickSeedsQuadratic() -> std::pair<Point<T>, Point<T>>;
   auto pickInternalSeedsQuadratic() -> std::pair<RNode *, RNode *>;
   auto calculateLinearCost(Point<T>, std::vector<Point<T>> &)
-      -> std::pair<NType, NType>;
+      -> std::pair<AreaType<T>, AreaType<T>>;
   auto calculateQuadraticCost(RNode *, std::vector<RNode *> &)
-      -> std::pair<NType, NType>;
-
-  void updateBoundingBox();
-
-  void adjustTree(RNode<T> *n, std::vector<RNode<T> *> &eliminated);
-  auto findLeaf(const Point<T> &point) -> RNode<T> *;
-  void condenseTree(RNode<T> *n, std::vector<RNode<T> *> &eliminated);
+      -> std::pair<AreaType<T>, AreaType<T>>;
+
+  void updateBoundingBox(const TreeParams<T> &params);
+  void updateAggregate(const TreeParams<T> &params);
+  void prefetchEntries() const;
+
+  // Looks up points[next++] until `points` runs out, suspending whenever
+  // the next step would touch memory it has only just prefetched
+  static auto searchLookups(const RNode *root,
+                            const std::vector<Point<T>> &points,
+                            size_t &next, std::vector<bool> &found)
+      -> Interleaved;
+
+  void adjustTree(RNode<T> *n, std::vector<RNode<T> *> &eliminated,
+                  const TreeParams<T> &params);
+  auto findLeaf(const Point<T> &point, std::vector<RNode<T> *> &path)
+      -> RNode<T> *;
+  void condenseTree(RNode<T> *n, std::vector<RNode<T> *> &eliminated,
+                    const TreeParams<T> &params);
 
 public:
   friend class RTree<T>;
+  friend class PersistentRTree<T>;
   bool isLeaf;
 
-  explicit RNode(size_t _minChildren = 3, size_t _maxChildren = 2,
-                 bool _isLeaf = true)
-      : parent(nullptr), minChildren(_minChildren), maxChildren(_maxChildren),
+  explicit RNode(bool _isLeaf = true)
+      : parent(nullptr), subtreeCount(0), refs(1), block(nullptr), diskId(0),
         isLeaf(_isLeaf) {}
 
-  RNode() : parent(nullptr), minChildren(2), maxChildren(3), isLeaf(true) {}
-
   auto search(const Point<T> &point) -> bool;
-  auto insert(const Point<T> &point)
+  auto insert(const Point<T> &point, const TreeParams<T> &params)
       -> std::optional<std::pair<RNode<T> *, RNode<T> *>>;
   auto query(const QueryBox<T> &q) -> std::vector<Point<T>>;
-  void remove(const Point<T> &point, std::vector<RNode *> &eliminated);
+  auto count(const QueryBox<T> &q) const -> size_t;
+  auto aggregate(const QueryBox<T> &q, const Monoid<T> &monoid) const
+      -> Safe<T>;
+  auto knn(const Point<T> &point, size_t k) const -> std::vector<Point<T>>;
+  void remove(const Point<T> &point, std::vector<RNode *> &eliminated,
+              const TreeParams<T> &params);
 
   [[nodiscard]] auto geChild(size_t i) const -> RNode * { return children[i]; }
   [[nodiscard]] auto getPoint(size_t i) const -> Point<T> { return points[i]; }
@@ -65,33 +115,115 @@ public:
   }
   [[nodiscard]] auto getParent() const -> RNode * { return parent; }
   [[nodiscard]] auto getBoundingBox() const -> MBB<T> { return boundingBox; }
+  [[nodiscard]] auto getCount() const -> size_t { return subtreeCount; }
+  [[nodiscard]] auto getAggregate() const -> Safe<T> {
+    return subtreeAggregate;
+  }
+  // Heap bytes held by this subtree, node headers included
+  [[nodiscard]] auto memoryUsage() const -> size_t;
   void print(size_t depth) const;
 };
 
-template <std::floating_point T = float> class RTree {
+template <Coordinate T = float> class RTree {
 private:
   RNode<T> *root;
-  uint minChildren;
-  uint maxChildren;
+  TreeParams<T> params;
+  std::shared_ptr<const Monoid<T>> monoid; // Owns params.monoid
+
+  RTree(RNode<T> *_root, const TreeParams<T> &_params,
+        std::shared_ptr<const Monoid<T>> _monoid)
+      : root(_root), params(_params), monoid(std::move(_monoid)) {}
+
+  void collectPoints(RNode<T> *node, std::vector<Point<T>> &out) const;
+  void makeRootExclusive();
+  // Recomputes the boxes and aggregates of path[from..0], bottom-up
+  void refreshPath(const std::vector<RNode<T> *> &path, size_t from);
+
+  friend class PersistentRTree<T>;
 
 public:
   RTree(uint _minChildren, uint _maxChildren)
-      : root(new RNode<T>(_minChildren, _maxChildren, true)),
-        minChildren(_minChildren), maxChildren(_maxChildren) {}
+      : root(new RNode<T>(true)),
+        params{_minChildren, _maxChildren, nullptr} {}
+
+  // Aggregate-augmented tree: every node keeps `_monoid` folded over its
+  // subtree so aggregate() can skip fully covered subtrees.
+  RTree(uint _minChildren, uint _maxChildren, Monoid<T> _monoid)
+      : root(new RNode<T>(true)),
+        params{_minChildren, _maxChildren, nullptr},
+        monoid(std::make_shared<const Monoid<T>>(std::move(_monoid))) {
+    params.monoid = monoid.get();
+    root->updateBoundingBox(params);
+  }
 
-  RTree() : root(new RNode<T>(2, 3, true)), minChildren(2), maxChildren(3) {}
-  ~RTree() { delete root; }
+  RTree() : root(new RNode<T>(true)), params{2, 3, nullptr} {}
+  ~RTree() {
+    if (root != nullptr) {
+      RNode<T>::release(root);
+    }
+  }
+
+  // Copies must be explicit, see clone() and share(). A moved-from tree may
+  // only be assigned to or destroyed.
+  RTree(const RTree &other) = delete;
+  auto operator=(const RTree &other) -> RTree & = delete;
+  RTree(RTree &&other) noexcept
+      : root(other.root), params(other.params),
+        monoid(std::move(other.monoid)) {
+    other.root = nullptr;
+  }
+  auto operator=(RTree &&other) noexcept -> RTree &;
+
+  // Deep copy in O(n); all nodes of the copy share one allocation
+  [[nodiscard]] auto clone() const -> RTree;
+  // O(1) copy-on-write snapshot. Both trees copy shared nodes lazily on
+  // their first write, so either one may be modified independently.
+  [[nodiscard]] auto share() const -> RTree;
+  // Read-only copy in one contiguous breadth-first array, for data that no
+  // longer changes
+  [[nodiscard]] auto freeze() const -> FrozenRTree<T>;
+  // Packs `points` bottom-up in Sort-Tile-Recursive order, without splits
+  static auto bulkLoad(std::vector<Point<T>> points, uint _minChildren,
+                       uint _maxChildren) -> RTree;
 
   auto search(const Point<T> &point) -> bool;
+  // search() for every point, keeping `inFlight` lookups in progress at
+  // once so their cache misses overlap. found[i] is the result for
+  // points[i].
+  [[nodiscard]] auto searchBatch(const std::vector<Point<T>> &points,
+                                 size_t inFlight = 8) const
+      -> std::vector<bool>;
   void insert(const Point<T> &point);
   void remove(const Point<T> &point);
+  // Moves one stored copy of `from` to `to`, returning false if `from` is
+  // not stored. A point staying within its leaf's box grown by `tolerance`
+  // on every side is updated in place; otherwise it is reinserted below the
+  // lowest ancestor covering `to`. Only moves that would split or underfill
+  // a node fall back to remove() and insert().
+  auto update(const Point<T> &from, const Point<T> &to, T tolerance = T{})
+      -> bool;
   auto query(const QueryBox<T> &q) -> std::vector<Point<T>>;
+  [[nodiscard]] auto count(const QueryBox<T> &q) const -> size_t;
+  [[nodiscard]] auto aggregate(const QueryBox<T> &q) const -> Safe<T>;
+  // The k stored points closest to `point`, nearest first
+  [[nodiscard]] auto knn(const Point<T> &point, size_t k) const
+      -> std::vector<Point<T>>;
+  [[nodiscard]] auto size() const -> size_t { return root->subtreeCount; }
+  [[nodiscard]] auto memoryUsage() const -> size_t {
+    return sizeof(*this) + root->memoryUsage();
+  }
 
   [[nodiscard]] auto getRoot() const -> RNode<T> * { return root; }
   void print() const;
 };
 
 extern template class RNode<float>;
+extern template class RNode<double>;
+extern template class RNode<int32_t>;
+extern template class RNode<int64_t>;
 extern template class RTree<float>;
+extern template class RTree<double>;
+extern template class RTree<int32_t>;
+extern template class RTree<int64_t>;
 
 #endif // RTREE_H
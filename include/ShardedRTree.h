@@ -0,0 +1,108 @@
+#ifndef SHARDED_RTREE_H
+#define SHARDED_RTREE_H
+
+#include "Rtree.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+// Splits the plane into columns by x and every column into rows by y. Cut
+// values belong to the region above them; the outer regions are unbounded.
+template <Coordinate T = float> struct SpatialPartition {
+  std::vector<T> xCuts;              // columns - 1 ascending values
+  std::vector<std::vector<T>> yCuts; // rows - 1 ascending values per column
+
+  // Uniform grid over `domain`
+  static auto grid(const MBB<T> &domain, size_t columns, size_t rows)
+      -> SpatialPartition;
+  // About `shards` regions holding similar shares of `sample`, cut at its
+  // x quantiles and then at the y quantiles within each column
+  static auto quantiles(std::vector<Point<T>> sample, size_t shards)
+      -> SpatialPartition;
+
+  [[nodiscard]] auto size() const -> size_t;
+  [[nodiscard]] auto shardOf(const Point<T> &point) const -> size_t;
+  [[nodiscard]] auto region(size_t shard) const -> MBB<T>;
+};
+
+struct ShardedOptions {
+  uint minChildren = 4;
+  uint maxChildren = 16;
+  // Operations queued per shard before producers wait for its writer
+  size_t queueCapacity = 1U << 16U;
+};
+
+// One RTree per region of a SpatialPartition, each owned by a writer
+// thread. insert() and remove() only queue the operation for the shard
+// holding the point, so producers on different regions never contend on a
+// tree lock, and writers apply their queue in batches. Reads take a shared
+// lock on every shard whose region intersects the query and see the
+// operations applied so far; flush() waits for all queued ones.
+template <Coordinate T = float> class ShardedRTree {
+private:
+  struct Operation {
+    bool insert;
+    Point<T> point;
+  };
+
+  struct Shard {
+    RTree<T> tree;
+    MBB<T> region;
+    mutable std::shared_mutex treeMutex;
+
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::vector<Operation> queue;
+    bool applying = false;
+    bool stopping = false;
+    std::thread writer;
+
+    Shard(uint minChildren, uint maxChildren, const MBB<T> &_region)
+        : tree(minChildren, maxChildren), region(_region) {}
+  };
+
+  SpatialPartition<T> partition;
+  ShardedOptions options;
+  std::vector<std::unique_ptr<Shard>> shards;
+
+  void enqueue(bool insert, const Point<T> &point);
+  static void writerLoop(Shard &shard);
+
+public:
+  explicit ShardedRTree(SpatialPartition<T> _partition,
+                        ShardedOptions _options = {});
+  ~ShardedRTree();
+
+  ShardedRTree(const ShardedRTree &other) = delete;
+  auto operator=(const ShardedRTree &other) -> ShardedRTree & = delete;
+  ShardedRTree(ShardedRTree &&other) = delete;
+  auto operator=(ShardedRTree &&other) -> ShardedRTree & = delete;
+
+  void insert(const Point<T> &point) { enqueue(true, point); }
+  void remove(const Point<T> &point) { enqueue(false, point); }
+  // Waits until every queued operation is applied
+  void flush();
+
+  [[nodiscard]] auto search(const Point<T> &point) const -> bool;
+  [[nodiscard]] auto query(const QueryBox<T> &q) const
+      -> std::vector<Point<T>>;
+  [[nodiscard]] auto count(const QueryBox<T> &q) const -> size_t;
+  [[nodiscard]] auto knn(const Point<T> &point, size_t k) const
+      -> std::vector<Point<T>>;
+  [[nodiscard]] auto size() const -> size_t;
+  [[nodiscard]] auto shardCount() const -> size_t { return shards.size(); }
+};
+
+extern template struct SpatialPartition<float>;
+extern template struct SpatialPartition<double>;
+extern template struct SpatialPartition<int32_t>;
+extern template struct SpatialPartition<int64_t>;
+extern template class ShardedRTree<float>;
+extern template class ShardedRTree<double>;
+extern template class ShardedRTree<int32_t>;
+extern template class ShardedRTree<int64_t>;
+
+#endif // SHARDED_RTREE_H
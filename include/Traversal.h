@@ -0,0 +1,51 @@
+#ifndef TRAVERSAL_H
+#define TRAVERSAL_H
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+// LIFO stack for iterative tree walks. The first N entries live inline, so
+// typical traversals never touch the heap; deeper walks spill to a vector.
+template <typename E, size_t N = 64> class SmallStack {
+private:
+  std::array<E, N> inlineItems; // Written by push() before any read
+  std::vector<E> overflow;
+  size_t used = 0;
+
+public:
+  void push(const E &item) {
+    if (used < N) {
+      inlineItems[used++] = item;
+    } else {
+      overflow.push_back(item);
+    }
+  }
+
+  auto pop() -> E {
+    if (!overflow.empty()) {
+      E item = overflow.back();
+      overflow.pop_back();
+      return item;
+    }
+    return inlineItems[--used];
+  }
+
+  void clear() {
+    overflow.clear();
+    used = 0;
+  }
+
+  [[nodiscard]] auto empty() const -> bool { return used == 0; }
+};
+
+// Hint the cache to start loading `address` while other work proceeds
+inline void prefetch(const void *address) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(address);
+#else
+  (void)address;
+#endif
+}
+
+#endif // TRAVERSAL_H
@@ -0,0 +1,203 @@
+#include "CachedRTree.h"
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <limits>
+
+namespace {
+// Multiples of `quantum` at or beyond `value` in the given direction.
+// Integral results past the limits of T are clamped to them.
+template <Coordinate T> auto roundDown(T value, T quantum) -> T {
+  if (!(quantum > T{})) {
+    return value;
+  }
+  if constexpr (std::integral<T>) {
+    T cell = value / quantum;
+    if (value % quantum != 0 && value < 0) {
+      --cell;
+    }
+    if (cell < std::numeric_limits<T>::lowest() / quantum) {
+      return std::numeric_limits<T>::lowest();
+    }
+    return static_cast<T>(cell * quantum);
+  } else {
+    return std::floor(value / quantum) * quantum;
+  }
+}
+
+template <Coordinate T> auto roundUp(T value, T quantum) -> T {
+  if (!(quantum > T{})) {
+    return value;
+  }
+  if constexpr (std::integral<T>) {
+    T cell = value / quantum;
+    if (value % quantum != 0 && value > 0) {
+      ++cell;
+    }
+    if (cell > std::numeric_limits<T>::max() / quantum) {
+      return std::numeric_limits<T>::max();
+    }
+    return static_cast<T>(cell * quantum);
+  } else {
+    return std::ceil(value / quantum) * quantum;
+  }
+}
+
+// Exact containment; MBB::contains() tolerates an epsilon, which could let
+// a slightly smaller cached box stand in for a larger query
+template <Coordinate T>
+auto covers(const MBB<T> &outer, const MBB<T> &inner) -> bool {
+  auto x = [](const Point<T> &point) { return point.getX().getValue(); };
+  auto y = [](const Point<T> &point) { return point.getY().getValue(); };
+  return x(outer.lowerLeft) <= x(inner.lowerLeft) &&
+         y(outer.lowerLeft) <= y(inner.lowerLeft) &&
+         x(inner.upperRight) <= x(outer.upperRight) &&
+         y(inner.upperRight) <= y(outer.upperRight);
+}
+
+auto nanosSince(std::chrono::steady_clock::time_point start) -> uint64_t {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count());
+}
+} // namespace
+
+template <Coordinate T>
+auto CachedRTree<T>::KeyHash::operator()(const Key &key) const -> size_t {
+  size_t hash = 0;
+  for (T value : key) {
+    hash ^= std::hash<T>{}(value) + 0x9e3779b97f4a7c15ULL + (hash << 6U) +
+            (hash >> 2U);
+  }
+  return hash;
+}
+
+template <Coordinate T>
+auto CachedRTree<T>::keyOf(const QueryBox<T> &q) const -> Key {
+  const MBB<T> &box = q.getMBB();
+  return {roundDown(box.lowerLeft.getX().getValue(), options.quantum),
+          roundDown(box.lowerLeft.getY().getValue(), options.quantum),
+          roundUp(box.upperRight.getX().getValue(), options.quantum),
+          roundUp(box.upperRight.getY().getValue(), options.quantum)};
+}
+
+template <Coordinate T>
+void CachedRTree<T>::store(const Key &key, std::vector<Point<T>> points) {
+  size_t bytes = sizeof(Entry) + points.capacity() * sizeof(Point<T>);
+  if (bytes > options.capacityBytes) {
+    return;
+  }
+  while (cachedBytes + bytes > options.capacityBytes) {
+    drop(std::prev(entries.end()));
+    ++counters.evictions;
+  }
+  MBB<T> box(Point<T>(key[0], key[1]), Point<T>(key[2], key[3]));
+  entries.push_front({key, box, std::move(points), bytes});
+  index[key] = entries.begin();
+  cachedBytes += bytes;
+}
+
+template <Coordinate T>
+void CachedRTree<T>::drop(typename std::list<Entry>::iterator entry) {
+  cachedBytes -= entry->bytes;
+  index.erase(entry->key);
+  entries.erase(entry);
+}
+
+template <Coordinate T> void CachedRTree<T>::invalidate(const Point<T> &point) {
+  for (auto it = entries.begin(); it != entries.end();) {
+    auto next = std::next(it);
+    if (it->box.contains(point)) {
+      drop(it);
+      ++counters.invalidations;
+    }
+    it = next;
+  }
+}
+
+template <Coordinate T> void CachedRTree<T>::insert(const Point<T> &point) {
+  invalidate(point);
+  tree.insert(point);
+}
+
+template <Coordinate T> void CachedRTree<T>::remove(const Point<T> &point) {
+  invalidate(point);
+  tree.remove(point);
+}
+
+template <Coordinate T>
+auto CachedRTree<T>::update(const Point<T> &from, const Point<T> &to,
+                            T tolerance) -> bool {
+  if (!tree.update(from, to, tolerance)) {
+    return false;
+  }
+  invalidate(from);
+  invalidate(to);
+  return true;
+}
+
+template <Coordinate T>
+auto CachedRTree<T>::query(const QueryBox<T> &q) -> std::vector<Point<T>> {
+  auto start = std::chrono::steady_clock::now();
+  auto exact = [&q](const std::vector<Point<T>> &points) {
+    std::vector<Point<T>> result;
+    for (const auto &point : points) {
+      if (q.contains(point)) {
+        result.push_back(point);
+      }
+    }
+    return result;
+  };
+
+  Key key = keyOf(q);
+  auto found = index.find(key);
+  if (found != index.end()) {
+    entries.splice(entries.begin(), entries, found->second);
+    const std::vector<Point<T>> &points = found->second->points;
+    // Unrounded keys are the query box itself
+    std::vector<Point<T>> result =
+        options.quantum > T{} ? exact(points) : points;
+    ++counters.hits;
+    counters.hitNanos += nanosSince(start);
+    return result;
+  }
+
+  // The smallest cached box around the rounded one holds every answer
+  MBB<T> box(Point<T>(key[0], key[1]), Point<T>(key[2], key[3]));
+  auto superset = entries.end();
+  for (auto it = entries.begin(); it != entries.end(); ++it) {
+    if (covers(it->box, box) &&
+        (superset == entries.end() ||
+         it->points.size() < superset->points.size())) {
+      superset = it;
+    }
+  }
+  if (superset != entries.end()) {
+    entries.splice(entries.begin(), entries, superset);
+    std::vector<Point<T>> result = exact(superset->points);
+    ++counters.supersetHits;
+    counters.hitNanos += nanosSince(start);
+    return result;
+  }
+
+  std::vector<Point<T>> points =
+      tree.query(QueryBox<T>(box.lowerLeft, box.upperRight));
+  std::vector<Point<T>> result =
+      options.quantum > T{} ? exact(points) : points;
+  store(key, std::move(points));
+  ++counters.misses;
+  counters.missNanos += nanosSince(start);
+  return result;
+}
+
+template <Coordinate T> void CachedRTree<T>::clear() {
+  entries.clear();
+  index.clear();
+  cachedBytes = 0;
+}
+
+template class CachedRTree<float>;
+template class CachedRTree<double>;
+template class CachedRTree<int32_t>;
+template class CachedRTree<int64_t>;
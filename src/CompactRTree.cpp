@@ -0,0 +1,232 @@
+#include "CompactRTree.h"
+#include "Flatten.h"
+#include "Traversal.h"
+#include <algorithm>
+#include <cmath>
+
+template <Coordinate T, std::unsigned_integral Q>
+template <std::unsigned_integral U>
+auto CompactRTree<T, Q>::cellSize(U extent) -> U {
+  // Chosen so that extent / cell < steps, keeping every cell index in range
+  return static_cast<U>(extent / steps + 1);
+}
+
+template <Coordinate T, std::unsigned_integral Q>
+auto CompactRTree<T, Q>::dequantize(T low, T high, Q q) -> T {
+  // The ends are exact so a box touching its parent's border stays inside
+  if (q == 0) {
+    return low;
+  }
+  if (q == steps) {
+    return high;
+  }
+  if constexpr (std::integral<T>) {
+    // Integral boxes use whole cells, so no value goes through floating point
+    using U = std::make_unsigned_t<T>;
+    U extent = static_cast<U>(static_cast<U>(high) - static_cast<U>(low));
+    U offset = static_cast<U>(cellSize(extent) * q);
+    return offset >= extent ? high
+                            : static_cast<T>(static_cast<U>(low) + offset);
+  } else {
+    return low + (high - low) * (static_cast<T>(q) / static_cast<T>(steps));
+  }
+}
+
+template <Coordinate T, std::unsigned_integral Q>
+auto CompactRTree<T, Q>::quantizeLow(T low, T high, T value) -> Q {
+  if (high <= low) {
+    return 0;
+  }
+  if constexpr (std::integral<T>) {
+    using U = std::make_unsigned_t<T>;
+    U extent = static_cast<U>(static_cast<U>(high) - static_cast<U>(low));
+    U offset = static_cast<U>(static_cast<U>(value) - static_cast<U>(low));
+    return static_cast<Q>(offset / cellSize(extent));
+  } else {
+    T scaled =
+        std::floor((value - low) / (high - low) * static_cast<T>(steps));
+    auto q = static_cast<Q>(std::clamp(scaled, T{0}, static_cast<T>(steps)));
+    // Step down until rounding errors can no longer push the bound inward
+    while (q > 0 && dequantize(low, high, q) > value) {
+      --q;
+    }
+    return q;
+  }
+}
+
+template <Coordinate T, std::unsigned_integral Q>
+auto CompactRTree<T, Q>::quantizeHigh(T low, T high, T value) -> Q {
+  if (high <= low) {
+    return steps;
+  }
+  if constexpr (std::integral<T>) {
+    using U = std::make_unsigned_t<T>;
+    U extent = static_cast<U>(static_cast<U>(high) - static_cast<U>(low));
+    U offset = static_cast<U>(static_cast<U>(value) - static_cast<U>(low));
+    U cell = cellSize(extent);
+    return static_cast<Q>(offset / cell + (offset % cell != 0 ? 1 : 0));
+  } else {
+    T scaled = std::ceil((value - low) / (high - low) * static_cast<T>(steps));
+    auto q = static_cast<Q>(std::clamp(scaled, T{0}, static_cast<T>(steps)));
+    while (q < steps && dequantize(low, high, q) < value) {
+      ++q;
+    }
+    return q;
+  }
+}
+
+template <Coordinate T, std::unsigned_integral Q>
+auto CompactRTree<T, Q>::quantize(const MBB<T> &parent, const MBB<T> &box)
+    -> QuantizedBox {
+  T lowX = parent.lowerLeft.getX().getValue();
+  T lowY = parent.lowerLeft.getY().getValue();
+  T highX = parent.upperRight.getX().getValue();
+  T highY = parent.upperRight.getY().getValue();
+  return {quantizeLow(lowX, highX, box.lowerLeft.getX().getValue()),
+          quantizeLow(lowY, highY, box.lowerLeft.getY().getValue()),
+          quantizeHigh(lowX, highX, box.upperRight.getX().getValue()),
+          quantizeHigh(lowY, highY, box.upperRight.getY().getValue())};
+}
+
+template <Coordinate T, std::unsigned_integral Q>
+auto CompactRTree<T, Q>::dequantize(const MBB<T> &parent,
+                                    const QuantizedBox &box) -> MBB<T> {
+  T lowX = parent.lowerLeft.getX().getValue();
+  T lowY = parent.lowerLeft.getY().getValue();
+  T highX = parent.upperRight.getX().getValue();
+  T highY = parent.upperRight.getY().getValue();
+  return MBB<T>(Point<T>(dequantize(lowX, highX, box[0]),
+                         dequantize(lowY, highY, box[1])),
+                Point<T>(dequantize(lowX, highX, box[2]),
+                         dequantize(lowY, highY, box[3])));
+}
+
+template <Coordinate T, std::unsigned_integral Q>
+CompactRTree<T, Q>::CompactRTree(const RTree<T> &tree) {
+  rootBox = tree.getRoot()->getBoundingBox();
+
+  // A node's box is quantized against its parent's dequantized box, which
+  // is what a query reconstructs. Parents come first in breadth-first order.
+  std::vector<MBB<T>> decoded;
+  flattenBreadthFirst(
+      tree, points,
+      [this, &decoded](const RNode<T> &source, uint32_t parent,
+                       uint32_t first, size_t size) {
+        if (size > std::numeric_limits<uint16_t>::max()) {
+          throw std::runtime_error("RTree is too large for a CompactRTree");
+        }
+        if (decoded.empty()) {
+          boxes.push_back({0, 0, steps, steps});
+          decoded.push_back(rootBox);
+        } else {
+          QuantizedBox box = quantize(decoded[parent], source.getBoundingBox());
+          boxes.push_back(box);
+          decoded.push_back(dequantize(decoded[parent], box));
+        }
+        // No larger than the number of points, which fits the indices
+        nodes.push_back({first, static_cast<uint32_t>(source.getCount()),
+                         static_cast<uint16_t>(size), source.isLeaf});
+      });
+}
+
+template <Coordinate T, std::unsigned_integral Q>
+auto CompactRTree<T, Q>::search(const Point<T> &point) const -> bool {
+  if (!rootBox.contains(point)) {
+    return false;
+  }
+  SmallStack<std::pair<uint32_t, MBB<T>>> pending;
+  pending.push({0, rootBox});
+  while (!pending.empty()) {
+    auto [index, box] = pending.pop();
+    const Node &node = nodes[index];
+    if (node.isLeaf) {
+      auto begin = points.begin() + node.first;
+      if (std::find(begin, begin + node.size, point) != begin + node.size) {
+        return true;
+      }
+      continue;
+    }
+    for (uint32_t child = node.first; child < node.first + node.size;
+         ++child) {
+      MBB<T> childBox = dequantize(box, boxes[child]);
+      if (childBox.contains(point)) {
+        pending.push({child, childBox});
+      }
+    }
+  }
+  return false;
+}
+
+template <Coordinate T, std::unsigned_integral Q>
+auto CompactRTree<T, Q>::query(const QueryBox<T> &q) const
+    -> std::vector<Point<T>> {
+  std::vector<Point<T>> result;
+  if (!q.intersects(rootBox)) {
+    return result;
+  }
+  SmallStack<std::pair<uint32_t, MBB<T>>> pending;
+  pending.push({0, rootBox});
+  while (!pending.empty()) {
+    auto [index, box] = pending.pop();
+    const Node &node = nodes[index];
+    if (node.isLeaf) {
+      for (uint32_t i = node.first; i < node.first + node.size; ++i) {
+        if (q.contains(points[i])) {
+          result.push_back(points[i]);
+        }
+      }
+      continue;
+    }
+    for (uint32_t child = node.first; child < node.first + node.size;
+         ++child) {
+      MBB<T> childBox = dequantize(box, boxes[child]);
+      if (q.intersects(childBox)) {
+        pending.push({child, childBox});
+      }
+    }
+  }
+  return result;
+}
+
+template <Coordinate T, std::unsigned_integral Q>
+auto CompactRTree<T, Q>::count(const QueryBox<T> &q) const -> size_t {
+  size_t result = 0;
+  if (!q.intersects(rootBox)) {
+    return result;
+  }
+  SmallStack<std::pair<uint32_t, MBB<T>>> pending;
+  pending.push({0, rootBox});
+  while (!pending.empty()) {
+    auto [index, box] = pending.pop();
+    const Node &node = nodes[index];
+    // A dequantized box may be larger than the real one, so containment
+    // still proves that every point below is inside the query
+    if (q.contains(box)) {
+      result += node.count;
+    } else if (node.isLeaf) {
+      for (uint32_t i = node.first; i < node.first + node.size; ++i) {
+        if (q.contains(points[i])) {
+          ++result;
+        }
+      }
+    } else {
+      for (uint32_t child = node.first; child < node.first + node.size;
+           ++child) {
+        MBB<T> childBox = dequantize(box, boxes[child]);
+        if (q.intersects(childBox)) {
+          pending.push({child, childBox});
+        }
+      }
+    }
+  }
+  return result;
+}
+
+template class CompactRTree<float, uint8_t>;
+template class CompactRTree<float, uint16_t>;
+template class CompactRTree<double, uint8_t>;
+template class CompactRTree<double, uint16_t>;
+template class CompactRTree<int32_t, uint8_t>;
+template class CompactRTree<int32_t, uint16_t>;
+template class CompactRTree<int64_t, uint8_t>;
+template class CompactRTree<int64_t, uint16_t>;
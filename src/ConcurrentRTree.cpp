@@ -0,0 +1,443 @@
+#include "ConcurrentRTree.h"
+#include "Traversal.h"
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <unordered_set>
+
+template <Coordinate T>
+auto ConcurrentRTree<T>::Node::box() const -> MBB<T> {
+  if (level == 0) {
+    if (points.empty()) {
+      return {};
+    }
+    MBB<T> result(points.front(), points.front());
+    for (const auto &point : points) {
+      result.expand(MBB<T>(point, point));
+    }
+    return result;
+  }
+  MBB<T> result = boxes.front();
+  for (const auto &entry : boxes) {
+    result.expand(entry);
+  }
+  return result;
+}
+
+template <Coordinate T>
+ConcurrentRTree<T>::ConcurrentRTree(uint _minChildren, uint _maxChildren)
+    : root(new Node(0)), counter(0), stored(0), maxChildren(_maxChildren) {
+  // Splits cut nodes in half, which must leave both halves at the minimum
+  if (_maxChildren < 2 || 2 * _minChildren > _maxChildren + 1) {
+    throw std::runtime_error("ConcurrentRTree needs 2 * min <= max + 1");
+  }
+}
+
+template <Coordinate T> ConcurrentRTree<T>::~ConcurrentRTree() {
+  for (uint32_t level = 0; level < root->level; ++level) {
+    Node *node = leftmost[level].load();
+    while (node != nullptr) {
+      Node *next = node->right;
+      delete node;
+      node = next;
+    }
+  }
+  delete root;
+}
+
+template <Coordinate T>
+auto ConcurrentRTree<T>::chooseSubtree(const Node &node, const Point<T> &point)
+    -> size_t {
+  // Least enlargement, ties broken by the smaller area
+  MBB<T> target(point, point);
+  size_t best = 0;
+  AreaType<T> bestCost = node.boxes[0].calculateExpansionCost(target);
+  for (size_t i = 1; i < node.boxes.size(); ++i) {
+    AreaType<T> cost = node.boxes[i].calculateExpansionCost(target);
+    if (cost < bestCost ||
+        (cost == bestCost && node.boxes[i].area() < node.boxes[best].area())) {
+      best = i;
+      bestCost = cost;
+    }
+  }
+  return best;
+}
+
+template <Coordinate T>
+void ConcurrentRTree<T>::distribute(Node *from, Node *to) {
+  // Sorts the entries along the axis where their centers spread the most
+  // and moves the upper half
+  size_t entries = from->entries();
+  auto center = [from](size_t i) {
+    if (from->level == 0) {
+      return std::pair{static_cast<double>(from->points[i].getX().getValue()),
+                       static_cast<double>(from->points[i].getY().getValue())};
+    }
+    const MBB<T> &box = from->boxes[i];
+    return std::pair{static_cast<double>(box.lowerLeft.getX().getValue()) +
+                         static_cast<double>(box.upperRight.getX().getValue()),
+                     static_cast<double>(box.lowerLeft.getY().getValue()) +
+                         static_cast<double>(box.upperRight.getY().getValue())};
+  };
+  auto [lowX, lowY] = center(0);
+  auto [highX, highY] = center(0);
+  for (size_t i = 1; i < entries; ++i) {
+    auto [x, y] = center(i);
+    lowX = std::min(lowX, x);
+    highX = std::max(highX, x);
+    lowY = std::min(lowY, y);
+    highY = std::max(highY, y);
+  }
+  bool byX = highX - lowX >= highY - lowY;
+  std::vector<size_t> order(entries);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return byX ? center(a).first < center(b).first
+               : center(a).second < center(b).second;
+  });
+
+  size_t keep = (entries + 1) / 2;
+  if (from->level == 0) {
+    std::vector<Point<T>> points;
+    for (size_t i : order) {
+      (points.size() < keep ? points : to->points).push_back(from->points[i]);
+    }
+    from->points = std::move(points);
+  } else {
+    std::vector<Node *> children;
+    std::vector<MBB<T>> boxes;
+    for (size_t i : order) {
+      bool stays = children.size() < keep;
+      (stays ? children : to->children).push_back(from->children[i]);
+      (stays ? boxes : to->boxes).push_back(from->boxes[i]);
+    }
+    from->children = std::move(children);
+    from->boxes = std::move(boxes);
+  }
+}
+
+template <Coordinate T> auto ConcurrentRTree<T>::split(Node *node) -> Node * {
+  // `node` stays the left half. The new node is only reachable through the
+  // right link until the caller posts it to the parent, still holding the
+  // latch on `node`.
+  auto *sibling = new Node(node->level);
+  distribute(node, sibling);
+  sibling->right = node->right;
+  sibling->nsn = node->nsn;
+  node->right = sibling;
+  return sibling;
+}
+
+template <Coordinate T> void ConcurrentRTree<T>::pushDown() {
+  // The root keeps its identity and moves its entries into two children
+  if (root->level + 1 >= maxLevels) {
+    throw std::runtime_error("ConcurrentRTree is too tall");
+  }
+  auto *left = new Node(root->level);
+  auto *rightHalf = new Node(root->level);
+  left->points = std::move(root->points);
+  left->children = std::move(root->children);
+  left->boxes = std::move(root->boxes);
+  distribute(left, rightHalf);
+  left->right = rightHalf;
+
+  root->points.clear();
+  root->children = {left, rightHalf};
+  root->boxes = {left->box(), rightHalf->box()};
+  leftmost[root->level].store(left);
+  ++root->level;
+}
+
+template <Coordinate T>
+auto ConcurrentRTree<T>::lockParent(Node *hint, uint64_t seen,
+                                    const Node *child, bool exclusive)
+    -> Node * {
+  auto lock = [exclusive](Node *node) {
+    exclusive ? node->latch.lock() : node->latch.lock_shared();
+  };
+  auto unlock = [exclusive](Node *node) {
+    exclusive ? node->latch.unlock() : node->latch.unlock_shared();
+  };
+  auto holds = [child](const Node *node) {
+    return std::find(node->children.begin(), node->children.end(), child) !=
+           node->children.end();
+  };
+  Node *node = hint;
+  lock(node);
+  if (node->level != child->level + 1) {
+    // The root was pushed down after `hint` was read, so its entries now
+    // sit somewhere on the level below it
+    unlock(node);
+    for (node = leftmost[child->level + 1].load(); node != nullptr;) {
+      lock(node);
+      if (holds(node)) {
+        return node;
+      }
+      Node *next = node->right;
+      unlock(node);
+      node = next;
+    }
+    throw std::runtime_error("ConcurrentRTree lost a parent entry");
+  }
+  // Entries only move right, into nodes split off after `seen`
+  while (!holds(node)) {
+    Node *next = node->nsn > seen ? node->right : nullptr;
+    unlock(node);
+    if (next == nullptr) {
+      throw std::runtime_error("ConcurrentRTree lost a parent entry");
+    }
+    node = next;
+    lock(node);
+  }
+  return node;
+}
+
+template <Coordinate T> void ConcurrentRTree<T>::insert(const Point<T> &point) {
+  // Descend with shared latches, remembering every node and the counter
+  // value seen there
+  SmallStack<std::pair<Node *, uint64_t>> path;
+  Node *node = root;
+  bool leaf = false;
+  while (true) {
+    if (leaf) {
+      node->latch.lock();
+      break;
+    }
+    node->latch.lock_shared();
+    if (node->level == 0) {
+      // Only the root can be a leaf here, and it may grow before the
+      // exclusive latch is taken
+      node->latch.unlock_shared();
+      node->latch.lock();
+      if (node->level == 0) {
+        break;
+      }
+      node->latch.unlock();
+      continue;
+    }
+    uint64_t seen = counter.load();
+    Node *next = node->children[chooseSubtree(*node, point)];
+    leaf = node->level == 1;
+    node->latch.unlock_shared();
+    path.push({node, seen});
+    node = next;
+  }
+  node->points.push_back(point);
+  stored.fetch_add(1);
+
+  // Once the path runs out the root was pushed down in the meantime, and
+  // lockParent() looks below it
+  auto nextStep = [&]() -> std::pair<Node *, uint64_t> {
+    if (path.empty()) {
+      return {root, std::numeric_limits<uint64_t>::max()};
+    }
+    return path.pop();
+  };
+  auto indexOf = [](const Node *parent, const Node *child) {
+    return static_cast<size_t>(
+        std::find(parent->children.begin(), parent->children.end(), child) -
+        parent->children.begin());
+  };
+
+  // Splits go up with the split node latched until it is posted
+  while (node->entries() > maxChildren) {
+    if (node == root) {
+      pushDown();
+      node->latch.unlock();
+      return;
+    }
+    Node *sibling = split(node);
+    auto [hint, seen] = nextStep();
+    Node *parent = lockParent(hint, seen, node, true);
+    parent->boxes[indexOf(parent, node)] = node->box();
+    parent->children.push_back(sibling);
+    parent->boxes.push_back(sibling->box());
+    // Readers that saw the parent before this post follow the right link
+    node->nsn = counter.fetch_add(1) + 1;
+    node->latch.unlock();
+    node = parent;
+  }
+  node->latch.unlock();
+
+  // Every entry above must cover the point before insert() returns. Entries
+  // enlarged by other inserts still on their way up do not count, so the
+  // walk always reaches the root, only latching exclusively to enlarge.
+  MBB<T> target(point, point);
+  while (node != root) {
+    auto [hint, seen] = nextStep();
+    Node *parent = lockParent(hint, seen, node, false);
+    bool covered = parent->boxes[indexOf(parent, node)].contains(target);
+    parent->latch.unlock_shared();
+    if (!covered) {
+      parent = lockParent(parent, seen, node, true);
+      parent->boxes[indexOf(parent, node)].expand(target);
+      parent->latch.unlock();
+    }
+    node = parent;
+  }
+}
+
+template <Coordinate T>
+auto ConcurrentRTree<T>::remove(const Point<T> &point) -> bool {
+  struct Visit {
+    Node *node;
+    uint64_t seen;
+    bool leaf;
+  };
+  SmallStack<Visit> pending;
+  pending.push({root, 0, false});
+  while (!pending.empty()) {
+    Visit visit = pending.pop();
+    Node *node = visit.node;
+    if (!visit.leaf) {
+      std::shared_lock lock(node->latch);
+      if (node->level == 0) {
+        // A leaf root, retried with an exclusive latch
+        pending.push({node, visit.seen, true});
+        continue;
+      }
+      if (node->right != nullptr && node->nsn > visit.seen) {
+        pending.push({node->right, visit.seen, false});
+      }
+      uint64_t seen = counter.load();
+      for (size_t i = 0; i < node->children.size(); ++i) {
+        if (node->boxes[i].contains(point)) {
+          pending.push({node->children[i], seen, node->level == 1});
+        }
+      }
+      continue;
+    }
+
+    std::unique_lock lock(node->latch);
+    if (node->level != 0) {
+      // The root grew since it was read
+      pending.push({node, visit.seen, false});
+      continue;
+    }
+    if (node->right != nullptr && node->nsn > visit.seen) {
+      pending.push({node->right, visit.seen, true});
+    }
+    auto found = std::find(node->points.begin(), node->points.end(), point);
+    if (found != node->points.end()) {
+      *found = node->points.back();
+      node->points.pop_back();
+      stored.fetch_sub(1);
+      return true;
+    }
+  }
+  return false;
+}
+
+template <Coordinate T>
+template <typename Visit>
+void ConcurrentRTree<T>::walk(const QueryBox<T> &q, Visit visit) const {
+  SmallStack<std::pair<Node *, uint64_t>> pending;
+  pending.push({root, 0});
+  while (!pending.empty()) {
+    auto [node, seen] = pending.pop();
+    std::shared_lock lock(node->latch);
+    // Split after the parent was read: part of the entries moved right
+    if (node->right != nullptr && node->nsn > seen) {
+      pending.push({node->right, seen});
+    }
+    if (node->level == 0) {
+      for (const auto &point : node->points) {
+        if (q.contains(point) && visit(point)) {
+          return;
+        }
+      }
+      continue;
+    }
+    uint64_t now = counter.load();
+    for (size_t i = 0; i < node->children.size(); ++i) {
+      if (q.intersects(node->boxes[i])) {
+        pending.push({node->children[i], now});
+      }
+    }
+  }
+}
+
+template <Coordinate T>
+auto ConcurrentRTree<T>::search(const Point<T> &point) const -> bool {
+  bool found = false;
+  walk(QueryBox<T>(point, point), [&](const Point<T> &candidate) {
+    found = candidate == point;
+    return found;
+  });
+  return found;
+}
+
+template <Coordinate T>
+auto ConcurrentRTree<T>::query(const QueryBox<T> &q) const
+    -> std::vector<Point<T>> {
+  std::vector<Point<T>> result;
+  walk(q, [&](const Point<T> &point) {
+    result.push_back(point);
+    return false;
+  });
+  return result;
+}
+
+template <Coordinate T>
+auto ConcurrentRTree<T>::count(const QueryBox<T> &q) const -> size_t {
+  size_t result = 0;
+  walk(q, [&](const Point<T> &) {
+    ++result;
+    return false;
+  });
+  return result;
+}
+
+template <Coordinate T> auto ConcurrentRTree<T>::height() const -> size_t {
+  std::shared_lock lock(root->latch);
+  return root->level + 1;
+}
+
+template <Coordinate T> auto ConcurrentRTree<T>::isValid() const -> bool {
+  // Every node is reached once from the root, and the chains of right links
+  // hold exactly the nodes reached on their level
+  std::unordered_set<const Node *> reached;
+  size_t points = 0;
+  SmallStack<const Node *> pending;
+  pending.push(root);
+  while (!pending.empty()) {
+    const Node *node = pending.pop();
+    if (!reached.insert(node).second) {
+      return false;
+    }
+    if (node->level == 0) {
+      points += node->points.size();
+      continue;
+    }
+    if (node->children.empty() ||
+        node->boxes.size() != node->children.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < node->children.size(); ++i) {
+      const Node *child = node->children[i];
+      if (child->level + 1 != node->level ||
+          (child->entries() > 0 && !node->boxes[i].contains(child->box()))) {
+        return false;
+      }
+      pending.push(child);
+    }
+  }
+
+  size_t chained = 1;
+  for (uint32_t level = 0; level < root->level; ++level) {
+    for (const Node *node = leftmost[level].load(); node != nullptr;
+         node = node->right) {
+      if (node->level != level || !reached.contains(node)) {
+        return false;
+      }
+      ++chained;
+    }
+  }
+  return chained == reached.size() && points == stored.load();
+}
+
+template class ConcurrentRTree<float>;
+template class ConcurrentRTree<double>;
+template class ConcurrentRTree<int32_t>;
+template class ConcurrentRTree<int64_t>;
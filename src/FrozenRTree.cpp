@@ -0,0 +1,128 @@
+#include "FrozenRTree.h"
+#include "Flatten.h"
+#include "Traversal.h"
+#include <algorithm>
+#include <queue>
+
+template <Coordinate T> FrozenRTree<T>::FrozenRTree(const RTree<T> &tree) {
+  flattenBreadthFirst(tree, points,
+                      [this](const RNode<T> &source, uint32_t /*parent*/,
+                             uint32_t first, size_t size) {
+                        nodes.push_back({source.getBoundingBox(),
+                                         source.getCount(), first,
+                                         static_cast<uint32_t>(size),
+                                         source.isLeaf});
+                      });
+  nodes.shrink_to_fit();
+}
+
+template <Coordinate T>
+auto FrozenRTree<T>::search(const Point<T> &point) const -> bool {
+  SmallStack<uint32_t> pending;
+  pending.push(0);
+  while (!pending.empty()) {
+    const Node &node = nodes[pending.pop()];
+    if (node.isLeaf) {
+      auto begin = points.begin() + node.first;
+      if (std::find(begin, begin + node.size, point) != begin + node.size) {
+        return true;
+      }
+      continue;
+    }
+    for (uint32_t child = node.first + node.size; child-- > node.first;) {
+      if (nodes[child].box.contains(point)) {
+        pending.push(child);
+      }
+    }
+  }
+  return false;
+}
+
+template <Coordinate T>
+auto FrozenRTree<T>::query(const QueryBox<T> &q) const
+    -> std::vector<Point<T>> {
+  std::vector<Point<T>> result;
+  SmallStack<uint32_t> pending;
+  pending.push(0);
+  while (!pending.empty()) {
+    const Node &node = nodes[pending.pop()];
+    if (node.isLeaf) {
+      for (uint32_t i = node.first; i < node.first + node.size; ++i) {
+        if (q.contains(points[i])) {
+          result.push_back(points[i]);
+        }
+      }
+      continue;
+    }
+    for (uint32_t child = node.first + node.size; child-- > node.first;) {
+      if (q.intersects(nodes[child].box)) {
+        pending.push(child);
+      }
+    }
+  }
+  return result;
+}
+
+template <Coordinate T>
+auto FrozenRTree<T>::count(const QueryBox<T> &q) const -> size_t {
+  size_t result = 0;
+  SmallStack<uint32_t> pending;
+  pending.push(0);
+  while (!pending.empty()) {
+    const Node &node = nodes[pending.pop()];
+    if (q.contains(node.box)) {
+      result += node.count;
+    } else if (node.isLeaf) {
+      for (uint32_t i = node.first; i < node.first + node.size; ++i) {
+        if (q.contains(points[i])) {
+          ++result;
+        }
+      }
+    } else {
+      for (uint32_t child = node.first; child < node.first + node.size;
+           ++child) {
+        if (q.intersects(nodes[child].box)) {
+          pending.push(child);
+        }
+      }
+    }
+  }
+  return result;
+}
+
+template <Coordinate T>
+auto FrozenRTree<T>::knn(const Point<T> &point, size_t k) const
+    -> std::vector<Point<T>> {
+  // Best-first search over node and point indices, as in RNode::knn
+  struct Entry {
+    double distance;
+    uint32_t index;
+    bool isPoint;
+    auto operator>(const Entry &other) const -> bool {
+      return distance > other.distance;
+    }
+  };
+  std::vector<Point<T>> result;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<>> pending;
+  pending.push({nodes[0].box.distanceSquared(point), 0, false});
+  while (!pending.empty() && result.size() < k) {
+    Entry entry = pending.top();
+    pending.pop();
+    if (entry.isPoint) {
+      result.push_back(points[entry.index]);
+      continue;
+    }
+    const Node &node = nodes[entry.index];
+    for (uint32_t i = node.first; i < node.first + node.size; ++i) {
+      const MBB<T> box =
+          node.isLeaf ? MBB<T>(points[i], points[i]) : nodes[i].box;
+      pending.push({box.distanceSquared(point), i, node.isLeaf});
+    }
+  }
+  return result;
+}
+
+template class FrozenRTree<float>;
+template class FrozenRTree<double>;
+template class FrozenRTree<int32_t>;
+template class FrozenRTree<int64_t>;
@@ -0,0 +1,449 @@
+#include "HilbertRTree.h"
+#include "Traversal.h"
+#include <algorithm>
+#include <limits>
+
+namespace {
+// Position of (x, y) on the Hilbert curve filling a 2^32 x 2^32 grid
+auto hilbertIndex(uint32_t x, uint32_t y) -> uint64_t {
+  uint64_t index = 0;
+  for (uint32_t s = 1U << 31U; s > 0; s >>= 1U) {
+    uint32_t rx = (x & s) != 0 ? 1 : 0;
+    uint32_t ry = (y & s) != 0 ? 1 : 0;
+    index += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+    // Rotate the quadrant so the curve continues where it left off
+    if (ry == 0) {
+      if (rx == 1) {
+        x = ~x;
+        y = ~y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return index;
+}
+
+// Maps `value` from [low, high] onto the 32-bit grid, clamping outside
+template <Coordinate T> auto gridCell(T value, T low, T high) -> uint32_t {
+  if (!(low < high)) {
+    return 0;
+  }
+  double scaled = (static_cast<double>(value) - static_cast<double>(low)) /
+                  (static_cast<double>(high) - static_cast<double>(low)) *
+                  static_cast<double>(std::numeric_limits<uint32_t>::max());
+  return static_cast<uint32_t>(std::clamp(
+      scaled, 0.0, static_cast<double>(std::numeric_limits<uint32_t>::max())));
+}
+
+// Concatenates the parts in order and deals the result back out in runs
+// that differ by at most one element
+template <typename E>
+void dealEvenly(const std::vector<std::vector<E> *> &parts) {
+  std::vector<E> all;
+  for (auto *part : parts) {
+    all.insert(all.end(), part->begin(), part->end());
+    part->clear();
+  }
+  size_t first = 0;
+  for (size_t i = 0; i < parts.size(); ++i) {
+    size_t size =
+        all.size() / parts.size() + (i < all.size() % parts.size() ? 1 : 0);
+    parts[i]->assign(all.begin() + static_cast<std::ptrdiff_t>(first),
+                     all.begin() + static_cast<std::ptrdiff_t>(first + size));
+    first += size;
+  }
+}
+} // namespace
+
+template <Coordinate T>
+HilbertRTree<T>::HilbertRTree(const MBB<T> &_domain, uint _minChildren,
+                              uint _maxChildren)
+    : domain(_domain), root(new Node(true)), minChildren(_minChildren),
+      maxChildren(_maxChildren), stored(0) {
+  // Every node below the root needs a sibling to cooperate with, and two
+  // underfull siblings merge into one node while a full root splits in
+  // two, both of which must respect the bounds
+  if (_minChildren < 2 || 2 * _minChildren > _maxChildren + 1) {
+    delete root;
+    throw std::runtime_error(
+        "HilbertRTree needs 2 <= min and 2 * min <= max + 1");
+  }
+}
+
+template <Coordinate T> HilbertRTree<T>::~HilbertRTree() {
+  SmallStack<Node *> pending;
+  pending.push(root);
+  while (!pending.empty()) {
+    Node *node = pending.pop();
+    for (auto *child : node->children) {
+      pending.push(child);
+    }
+    delete node;
+  }
+}
+
+template <Coordinate T>
+auto HilbertRTree<T>::keyOf(const Point<T> &point) const -> uint64_t {
+  return hilbertIndex(gridCell(point.getX().getValue(),
+                               domain.lowerLeft.getX().getValue(),
+                               domain.upperRight.getX().getValue()),
+                      gridCell(point.getY().getValue(),
+                               domain.lowerLeft.getY().getValue(),
+                               domain.upperRight.getY().getValue()));
+}
+
+template <Coordinate T> auto HilbertRTree<T>::refresh(Node *node) -> bool {
+  // Returns whether the box or the LHV changed
+  MBB<T> box;
+  uint64_t lhv = 0;
+  if (node->isLeaf) {
+    if (node->entries.empty()) {
+      return false;
+    }
+    box = MBB<T>(node->entries.front().point, node->entries.front().point);
+    for (const auto &entry : node->entries) {
+      box.expand(MBB<T>(entry.point, entry.point));
+    }
+    lhv = node->entries.back().key;
+  } else {
+    box = node->children.front()->box;
+    for (const auto *child : node->children) {
+      box.expand(child->box);
+    }
+    lhv = node->children.back()->lhv;
+  }
+  bool changed = lhv != node->lhv ||
+                 !(box.lowerLeft == node->box.lowerLeft &&
+                   box.upperRight == node->box.upperRight);
+  node->box = box;
+  node->lhv = lhv;
+  return changed;
+}
+
+template <Coordinate T>
+void HilbertRTree<T>::spread(const std::vector<Node *> &group) {
+  // The group is a run of adjacent siblings, so key order is preserved
+  if (group.front()->isLeaf) {
+    std::vector<std::vector<Entry> *> parts;
+    for (auto *node : group) {
+      parts.push_back(&node->entries);
+    }
+    dealEvenly(parts);
+  } else {
+    std::vector<std::vector<Node *> *> parts;
+    for (auto *node : group) {
+      parts.push_back(&node->children);
+    }
+    dealEvenly(parts);
+  }
+  for (auto *node : group) {
+    refresh(node);
+  }
+}
+
+template <Coordinate T> void HilbertRTree<T>::insert(const Point<T> &point) {
+  uint64_t key = keyOf(point);
+  Path path;
+  Node *node = root;
+  while (!node->isLeaf) {
+    // First child whose keys reach past the new one, or the last child
+    auto it = std::lower_bound(
+        node->children.begin(), node->children.end(), key,
+        [](const Node *child, uint64_t k) { return child->lhv < k; });
+    auto index = static_cast<size_t>(it - node->children.begin());
+    index = std::min(index, node->children.size() - 1);
+    path.emplace_back(node, index);
+    node = node->children[index];
+  }
+  auto at = std::upper_bound(
+      node->entries.begin(), node->entries.end(), key,
+      [](uint64_t k, const Entry &entry) { return k < entry.key; });
+  node->entries.insert(at, {key, point});
+  ++stored;
+  handleOverflow(node, path);
+}
+
+template <Coordinate T>
+void HilbertRTree<T>::handleOverflow(Node *node, Path &path) {
+  while (true) {
+    if (node->size() <= maxChildren) {
+      // Nothing above changes once a node keeps its box and LHV
+      if (!refresh(node) || path.empty()) {
+        return;
+      }
+      node = path.back().first;
+      path.pop_back();
+      continue;
+    }
+    if (path.empty()) {
+      // A full root has no siblings: it moves below a new root and splits
+      auto *newRoot = new Node(false);
+      newRoot->children = {root, new Node(root->isLeaf)};
+      spread(newRoot->children);
+      refresh(newRoot);
+      root = newRoot;
+      return;
+    }
+
+    auto [parent, index] = path.back();
+    path.pop_back();
+    auto &siblings = parent->children;
+    // Cooperate with the right sibling, or the left one for the last child
+    size_t left = index + 1 < siblings.size() ? index : index - 1;
+    std::vector<Node *> group = {siblings[left], siblings[left + 1]};
+    if (group[0]->size() + group[1]->size() > 2 * maxChildren) {
+      // Both full: split two into three
+      auto *extra = new Node(node->isLeaf);
+      siblings.insert(siblings.begin() + static_cast<std::ptrdiff_t>(left + 2),
+                      extra);
+      group.push_back(extra);
+    }
+    spread(group);
+    node = parent;
+  }
+}
+
+template <Coordinate T>
+auto HilbertRTree<T>::findLeaf(const Point<T> &point, uint64_t key,
+                               Path &path) const -> Node * {
+  // Only children whose key range can hold `key` are searched
+  SmallStack<std::pair<Node *, size_t>> pending;
+  std::vector<Node *> nodes;
+  pending.push({root, 0});
+  while (!pending.empty()) {
+    auto [node, depth] = pending.pop();
+    nodes.resize(depth);
+    nodes.push_back(node);
+    if (node->isLeaf) {
+      auto [first, last] = std::equal_range(
+          node->entries.begin(), node->entries.end(), Entry{key, point},
+          [](const Entry &a, const Entry &b) { return a.key < b.key; });
+      if (std::find_if(first, last, [&](const Entry &entry) {
+            return entry.point == point;
+          }) == last) {
+        continue;
+      }
+      path.clear();
+      for (size_t i = 0; i + 1 < nodes.size(); ++i) {
+        const auto &children = nodes[i]->children;
+        path.emplace_back(nodes[i],
+                          static_cast<size_t>(std::find(children.begin(),
+                                                        children.end(),
+                                                        nodes[i + 1]) -
+                                              children.begin()));
+      }
+      return node;
+    }
+    for (size_t i = node->children.size(); i-- > 0;) {
+      const Node *child = node->children[i];
+      bool inRange = child->lhv >= key &&
+                     (i == 0 || node->children[i - 1]->lhv <= key);
+      if (inRange && child->box.contains(point)) {
+        pending.push({node->children[i], depth + 1});
+      }
+    }
+  }
+  return nullptr;
+}
+
+template <Coordinate T>
+auto HilbertRTree<T>::remove(const Point<T> &point) -> bool {
+  uint64_t key = keyOf(point);
+  Path path;
+  Node *leaf = findLeaf(point, key, path);
+  if (leaf == nullptr) {
+    return false;
+  }
+  auto [first, last] = std::equal_range(
+      leaf->entries.begin(), leaf->entries.end(), Entry{key, point},
+      [](const Entry &a, const Entry &b) { return a.key < b.key; });
+  leaf->entries.erase(std::find_if(
+      first, last, [&](const Entry &entry) { return entry.point == point; }));
+  --stored;
+  handleUnderflow(leaf, path);
+  return true;
+}
+
+template <Coordinate T>
+void HilbertRTree<T>::handleUnderflow(Node *node, Path &path) {
+  while (!path.empty()) {
+    auto [parent, index] = path.back();
+    path.pop_back();
+    if (node->size() >= minChildren) {
+      refresh(node);
+    } else {
+      auto &siblings = parent->children;
+      size_t left = index + 1 < siblings.size() ? index : index - 1;
+      std::vector<Node *> group = {siblings[left], siblings[left + 1]};
+      if (group[0]->size() + group[1]->size() >= 2 * minChildren) {
+        // Borrow from the sibling
+        spread(group);
+      } else {
+        // Merge the pair into its left node
+        if (group[0]->isLeaf) {
+          group[0]->entries.insert(group[0]->entries.end(),
+                                   group[1]->entries.begin(),
+                                   group[1]->entries.end());
+        } else {
+          group[0]->children.insert(group[0]->children.end(),
+                                    group[1]->children.begin(),
+                                    group[1]->children.end());
+          group[1]->children.clear();
+        }
+        siblings.erase(siblings.begin() +
+                       static_cast<std::ptrdiff_t>(left + 1));
+        delete group[1];
+        refresh(group[0]);
+      }
+    }
+    node = parent;
+  }
+  refresh(root);
+  // Shorten the tree while the root has a single child
+  while (!root->isLeaf && root->children.size() == 1) {
+    Node *child = root->children.front();
+    root->children.clear();
+    delete root;
+    root = child;
+  }
+}
+
+template <Coordinate T>
+auto HilbertRTree<T>::search(const Point<T> &point) const -> bool {
+  Path path;
+  return findLeaf(point, keyOf(point), path) != nullptr;
+}
+
+template <Coordinate T>
+auto HilbertRTree<T>::query(const QueryBox<T> &q) const
+    -> std::vector<Point<T>> {
+  std::vector<Point<T>> result;
+  SmallStack<const Node *> pending;
+  pending.push(root);
+  while (!pending.empty()) {
+    const Node *node = pending.pop();
+    if (node->isLeaf) {
+      for (const auto &entry : node->entries) {
+        if (q.contains(entry.point)) {
+          result.push_back(entry.point);
+        }
+      }
+      continue;
+    }
+    for (const auto *child : node->children) {
+      if (q.intersects(child->box)) {
+        pending.push(child);
+      }
+    }
+  }
+  return result;
+}
+
+template <Coordinate T>
+auto HilbertRTree<T>::count(const QueryBox<T> &q) const -> size_t {
+  size_t result = 0;
+  SmallStack<const Node *> pending;
+  pending.push(root);
+  while (!pending.empty()) {
+    const Node *node = pending.pop();
+    if (node->isLeaf) {
+      for (const auto &entry : node->entries) {
+        if (q.contains(entry.point)) {
+          ++result;
+        }
+      }
+      continue;
+    }
+    for (const auto *child : node->children) {
+      if (q.intersects(child->box)) {
+        pending.push(child);
+      }
+    }
+  }
+  return result;
+}
+
+template <Coordinate T> auto HilbertRTree<T>::height() const -> size_t {
+  size_t result = 1;
+  for (const Node *node = root; !node->isLeaf; node = node->children.front()) {
+    ++result;
+  }
+  return result;
+}
+
+template <Coordinate T> auto HilbertRTree<T>::nodeCount() const -> size_t {
+  size_t result = 0;
+  SmallStack<const Node *> pending;
+  pending.push(root);
+  while (!pending.empty()) {
+    const Node *node = pending.pop();
+    ++result;
+    for (const auto *child : node->children) {
+      pending.push(child);
+    }
+  }
+  return result;
+}
+
+template <Coordinate T> auto HilbertRTree<T>::memoryUsage() const -> size_t {
+  size_t bytes = sizeof(*this);
+  SmallStack<const Node *> pending;
+  pending.push(root);
+  while (!pending.empty()) {
+    const Node *node = pending.pop();
+    bytes += sizeof(Node) + node->entries.capacity() * sizeof(Entry) +
+             node->children.capacity() * sizeof(Node *);
+    for (const auto *child : node->children) {
+      pending.push(child);
+    }
+  }
+  return bytes;
+}
+
+template <Coordinate T> auto HilbertRTree<T>::isValid() const -> bool {
+  // Children are visited left to right, so keys must never decrease
+  size_t leafDepth = height() - 1;
+  size_t points = 0;
+  uint64_t previous = 0;
+  SmallStack<std::pair<const Node *, size_t>> pending;
+  pending.push({root, 0});
+  while (!pending.empty()) {
+    auto [node, depth] = pending.pop();
+    if (node != root &&
+        (node->size() < minChildren || node->size() > maxChildren)) {
+      return false;
+    }
+    if (node->isLeaf) {
+      if (depth != leafDepth) {
+        return false;
+      }
+      for (const auto &entry : node->entries) {
+        if (entry.key < previous || entry.key != keyOf(entry.point) ||
+            !node->box.contains(entry.point)) {
+          return false;
+        }
+        previous = entry.key;
+      }
+      if (!node->entries.empty() && node->lhv != node->entries.back().key) {
+        return false;
+      }
+      points += node->entries.size();
+      continue;
+    }
+    if (node->children.empty() || node->lhv != node->children.back()->lhv) {
+      return false;
+    }
+    for (size_t i = node->children.size(); i-- > 0;) {
+      if (!node->box.contains(node->children[i]->box)) {
+        return false;
+      }
+      pending.push({node->children[i], depth + 1});
+    }
+  }
+  return points == stored;
+}
+
+template class HilbertRTree<float>;
+template class HilbertRTree<double>;
+template class HilbertRTree<int32_t>;
+template class HilbertRTree<int64_t>;
@@ -0,0 +1,375 @@
+#include "LsmRTree.h"
+#include <algorithm>
+#include <utility>
+
+namespace {
+// Exact coordinate order, used to match tombstones with stored copies
+template <Coordinate T>
+auto rawLess(const Point<T> &a, const Point<T> &b) -> bool {
+  return std::pair{a.getX().getValue(), a.getY().getValue()} <
+         std::pair{b.getX().getValue(), b.getY().getValue()};
+}
+
+template <Coordinate T>
+auto everything(const RTree<T> &tree) -> std::vector<Point<T>> {
+  const MBB<T> box = tree.getRoot()->getBoundingBox();
+  return tree.getRoot()->query(QueryBox<T>(box.lowerLeft, box.upperRight));
+}
+} // namespace
+
+template <Coordinate T>
+LsmRTree<T>::LsmRTree(LsmOptions _options)
+    : options(_options), stopping(false), compactor([this] { compactLoop(); }) {
+  buffer.reserve(options.bufferCapacity);
+}
+
+template <Coordinate T> LsmRTree<T>::~LsmRTree() {
+  {
+    std::unique_lock lock(mutex);
+    stopping = true;
+  }
+  changed.notify_all();
+  compactor.join();
+}
+
+template <Coordinate T> void LsmRTree<T>::insert(const Point<T> &point) {
+  std::unique_lock lock(mutex);
+  buffer.push_back(point);
+  if (buffer.size() + bufferTombstones.size() >= options.bufferCapacity) {
+    freeze(lock);
+  }
+}
+
+template <Coordinate T> void LsmRTree<T>::remove(const Point<T> &point) {
+  std::unique_lock lock(mutex);
+  auto found = std::find(buffer.begin(), buffer.end(), point);
+  if (found != buffer.end()) {
+    *found = buffer.back();
+    buffer.pop_back();
+    return;
+  }
+  // Only tombstones with a live target are kept, so every tombstone
+  // cancels exactly one stored copy
+  if (liveCopies(point) == 0) {
+    return;
+  }
+  bufferTombstones.push_back(point);
+  if (buffer.size() + bufferTombstones.size() >= options.bufferCapacity) {
+    freeze(lock);
+  }
+}
+
+template <Coordinate T> void LsmRTree<T>::flush() {
+  std::unique_lock lock(mutex);
+  freeze(lock);
+  changed.wait(lock, [this] { return !hasWork(); });
+}
+
+template <Coordinate T>
+void LsmRTree<T>::freeze(std::unique_lock<std::shared_mutex> &lock) {
+  if (!buffer.empty() || !bufferTombstones.empty()) {
+    auto run = std::make_shared<Run>();
+    run->entries = buffer.size();
+    run->points = std::move(buffer);
+    run->tombstones = std::move(bufferTombstones);
+    buffer = {};
+    bufferTombstones = {};
+    buffer.reserve(options.bufferCapacity);
+    runs.insert(runs.begin(), std::move(run));
+    changed.notify_all();
+  }
+
+  // Back pressure: readers scan frozen buffers linearly, so writers wait
+  // when the packing thread falls behind
+  changed.wait(lock, [this] {
+    return stopping ||
+           static_cast<size_t>(std::count_if(
+               runs.begin(), runs.end(), [](const RunPtr &run) {
+                 return !run->packed();
+               })) < options.maxFrozenRuns;
+  });
+}
+
+template <Coordinate T> auto LsmRTree<T>::hasWork() const -> bool {
+  for (size_t i = 0; i < runs.size(); ++i) {
+    if (!runs[i]->packed()) {
+      return true;
+    }
+    if (i + 1 < runs.size() && runs[i + 1]->packed() &&
+        runs[i + 1]->entries + runs[i + 1]->tombstones.size() <=
+            options.mergeRatio *
+                (runs[i]->entries + runs[i]->tombstones.size())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <Coordinate T> void LsmRTree<T>::compactLoop() {
+  std::unique_lock lock(mutex);
+  while (true) {
+    changed.wait(lock, [this] { return stopping || hasWork(); });
+    if (stopping) {
+      return;
+    }
+
+    // Frozen buffers are packed first, oldest first. Otherwise the oldest
+    // pair of runs of similar size is merged.
+    RunPtr newer;
+    RunPtr older;
+    bool oldest = false;
+    auto unpacked = std::find_if(runs.rbegin(), runs.rend(),
+                                 [](const RunPtr &run) {
+                                   return !run->packed();
+                                 });
+    if (unpacked != runs.rend()) {
+      newer = *unpacked;
+    } else {
+      for (size_t i = runs.size() - 1; i-- > 0;) {
+        if (runs[i + 1]->entries + runs[i + 1]->tombstones.size() <=
+            options.mergeRatio *
+                (runs[i]->entries + runs[i]->tombstones.size())) {
+          newer = runs[i];
+          older = runs[i + 1];
+          oldest = i + 2 == runs.size();
+          break;
+        }
+      }
+    }
+
+    // Runs are immutable and writers only prepend, so the work happens
+    // without the lock and the result replaces its inputs in place
+    lock.unlock();
+    RunPtr result = older ? merge(*newer, *older, oldest) : pack(*newer);
+    lock.lock();
+
+    auto position = std::find(runs.begin(), runs.end(), newer);
+    *position = std::move(result);
+    if (older) {
+      runs.erase(position + 1);
+    }
+    changed.notify_all();
+  }
+}
+
+template <Coordinate T>
+auto LsmRTree<T>::pack(const Run &run) const -> RunPtr {
+  auto packed = std::make_shared<Run>();
+  packed->tree = RTree<T>::bulkLoad(run.points, options.minChildren,
+                                    options.maxChildren);
+  packed->tombstones = run.tombstones;
+  packed->entries = run.entries;
+  return packed;
+}
+
+template <Coordinate T>
+auto LsmRTree<T>::merge(const Run &newer, const Run &older, bool oldest) const
+    -> RunPtr {
+  std::vector<Point<T>> points = everything(*older.tree);
+  std::vector<Point<T>> unmatched = cancel(points, newer.tombstones);
+  std::vector<Point<T>> newerPoints = everything(*newer.tree);
+  points.insert(points.end(), newerPoints.begin(), newerPoints.end());
+
+  auto merged = std::make_shared<Run>();
+  merged->entries = points.size();
+  merged->tree = RTree<T>::bulkLoad(std::move(points), options.minChildren,
+                                    options.maxChildren);
+  // Tombstones are only needed while an older run may hold their target
+  if (!oldest) {
+    merged->tombstones = std::move(unmatched);
+    merged->tombstones.insert(merged->tombstones.end(),
+                              older.tombstones.begin(),
+                              older.tombstones.end());
+  }
+  return merged;
+}
+
+template <Coordinate T>
+auto LsmRTree<T>::cancel(std::vector<Point<T>> &points,
+                         std::vector<Point<T>> tombstones)
+    -> std::vector<Point<T>> {
+  if (tombstones.empty()) {
+    return tombstones;
+  }
+  std::sort(points.begin(), points.end(), rawLess<T>);
+  std::sort(tombstones.begin(), tombstones.end(), rawLess<T>);
+
+  std::vector<Point<T>> kept;
+  std::vector<Point<T>> unmatched;
+  kept.reserve(points.size());
+  size_t next = 0;
+  for (const auto &point : points) {
+    while (next < tombstones.size() && rawLess(tombstones[next], point)) {
+      unmatched.push_back(tombstones[next++]);
+    }
+    if (next < tombstones.size() && !rawLess(point, tombstones[next])) {
+      ++next;
+      continue;
+    }
+    kept.push_back(point);
+  }
+  unmatched.insert(unmatched.end(),
+                   tombstones.begin() + static_cast<std::ptrdiff_t>(next),
+                   tombstones.end());
+  points = std::move(kept);
+  return unmatched;
+}
+
+template <Coordinate T>
+auto LsmRTree<T>::liveCopies(const Point<T> &point) const -> size_t {
+  // Every tombstone has a live target, so copies minus tombstones is exact
+  QueryBox<T> at(point, point);
+  size_t copies = static_cast<size_t>(
+      std::count(buffer.begin(), buffer.end(), point));
+  size_t cancelled = static_cast<size_t>(
+      std::count(bufferTombstones.begin(), bufferTombstones.end(), point));
+  for (const auto &run : runs) {
+    if (run->packed()) {
+      copies += run->tree->count(at);
+    } else {
+      copies += static_cast<size_t>(
+          std::count(run->points.begin(), run->points.end(), point));
+    }
+    cancelled += static_cast<size_t>(
+        std::count(run->tombstones.begin(), run->tombstones.end(), point));
+  }
+  return copies - cancelled;
+}
+
+template <Coordinate T>
+auto LsmRTree<T>::snapshot(const QueryBox<T> *q, std::vector<Point<T>> &points,
+                           std::vector<Point<T>> &tombstones) const
+    -> std::vector<RunPtr> {
+  std::shared_lock lock(mutex);
+  for (const auto &point : buffer) {
+    if (q == nullptr || q->contains(point)) {
+      points.push_back(point);
+    }
+  }
+  for (const auto &tombstone : bufferTombstones) {
+    if (q == nullptr || q->contains(tombstone)) {
+      tombstones.push_back(tombstone);
+    }
+  }
+  return runs;
+}
+
+template <Coordinate T>
+void LsmRTree<T>::runQuery(const Run &run, const QueryBox<T> &q,
+                           std::vector<Point<T>> &out) {
+  if (run.packed()) {
+    std::vector<Point<T>> found = run.tree->getRoot()->query(q);
+    out.insert(out.end(), found.begin(), found.end());
+    return;
+  }
+  for (const auto &point : run.points) {
+    if (q.contains(point)) {
+      out.push_back(point);
+    }
+  }
+}
+
+template <Coordinate T>
+auto LsmRTree<T>::search(const Point<T> &point) const -> bool {
+  std::shared_lock lock(mutex);
+  return liveCopies(point) > 0;
+}
+
+template <Coordinate T>
+auto LsmRTree<T>::query(const QueryBox<T> &q) const -> std::vector<Point<T>> {
+  std::vector<Point<T>> result;
+  std::vector<Point<T>> tombstones;
+  for (const auto &run : snapshot(&q, result, tombstones)) {
+    runQuery(*run, q, result);
+    for (const auto &tombstone : run->tombstones) {
+      if (q.contains(tombstone)) {
+        tombstones.push_back(tombstone);
+      }
+    }
+  }
+  cancel(result, std::move(tombstones));
+  return result;
+}
+
+template <Coordinate T>
+auto LsmRTree<T>::count(const QueryBox<T> &q) const -> size_t {
+  std::vector<Point<T>> buffered;
+  std::vector<Point<T>> tombstones;
+  size_t result = 0;
+  for (const auto &run : snapshot(&q, buffered, tombstones)) {
+    if (run->packed()) {
+      result += run->tree->count(q);
+    } else {
+      result += static_cast<size_t>(
+          std::count_if(run->points.begin(), run->points.end(),
+                        [&q](const Point<T> &point) {
+                          return q.contains(point);
+                        }));
+    }
+    for (const auto &tombstone : run->tombstones) {
+      if (q.contains(tombstone)) {
+        tombstones.push_back(tombstone);
+      }
+    }
+  }
+  // A tombstone's target is the same point, so it lies inside `q` as well
+  return result + buffered.size() - tombstones.size();
+}
+
+template <Coordinate T>
+auto LsmRTree<T>::knn(const Point<T> &point, size_t k) const
+    -> std::vector<Point<T>> {
+  std::vector<Point<T>> candidates;
+  std::vector<Point<T>> tombstones;
+  std::vector<RunPtr> current = snapshot(nullptr, candidates, tombstones);
+  for (const auto &run : current) {
+    tombstones.insert(tombstones.end(), run->tombstones.begin(),
+                      run->tombstones.end());
+  }
+
+  // A live point among the k nearest is within the k + tombstones nearest
+  // of its own run, whatever the tombstones cancel
+  size_t depth = k + tombstones.size();
+  for (const auto &run : current) {
+    if (run->packed()) {
+      std::vector<Point<T>> found = run->tree->knn(point, depth);
+      candidates.insert(candidates.end(), found.begin(), found.end());
+    } else {
+      candidates.insert(candidates.end(), run->points.begin(),
+                        run->points.end());
+    }
+  }
+  cancel(candidates, std::move(tombstones));
+
+  auto distance = [&point](const Point<T> &candidate) {
+    return MBB<T>(candidate, candidate).distanceSquared(point);
+  };
+  k = std::min(k, candidates.size());
+  std::partial_sort(candidates.begin(),
+                    candidates.begin() + static_cast<std::ptrdiff_t>(k),
+                    candidates.end(),
+                    [&](const Point<T> &a, const Point<T> &b) {
+                      return distance(a) < distance(b);
+                    });
+  candidates.resize(k);
+  return candidates;
+}
+
+template <Coordinate T> auto LsmRTree<T>::size() const -> size_t {
+  std::shared_lock lock(mutex);
+  size_t result = buffer.size() - bufferTombstones.size();
+  for (const auto &run : runs) {
+    result += run->entries - run->tombstones.size();
+  }
+  return result;
+}
+
+template <Coordinate T> auto LsmRTree<T>::runCount() const -> size_t {
+  std::shared_lock lock(mutex);
+  return runs.size();
+}
+
+template class LsmRTree<float>;
+template class LsmRTree<double>;
+template class LsmRTree<int32_t>;
+template class LsmRTree<int64_t>;
@@ -1,6 +1,31 @@
 #include "MBB.h"
 
-template <std::floating_point T>
+namespace {
+// Distance between two coordinates in the area type, widened before the
+// subtraction so integral extents cannot overflow
+template <Coordinate T>
+auto span(const Safe<T> &low, const Safe<T> &high) -> AreaType<T> {
+  using Wide = typename AreaOf<T>::type;
+  return AreaType<T>(static_cast<Wide>(high.getValue()) -
+                     static_cast<Wide>(low.getValue()));
+}
+
+// Product of two non-negative spans. Integral areas saturate instead of
+// overflowing once both extents approach the full coordinate range.
+template <Coordinate T>
+auto product(const AreaType<T> &a, const AreaType<T> &b) -> AreaType<T> {
+  using Wide = typename AreaOf<T>::type;
+  if constexpr (std::integral<Wide>) {
+    if (a.getValue() != 0 &&
+        b.getValue() > std::numeric_limits<Wide>::max() / a.getValue()) {
+      return AreaType<T>(std::numeric_limits<Wide>::max());
+    }
+  }
+  return a * b;
+}
+} // namespace
+
+template <Coordinate T>
 auto MBB<T>::intersects(const MBB &other) const -> bool {
   return !(lowerLeft.getX() > other.upperRight.getX() ||
            upperRight.getX() < other.lowerLeft.getX() ||
@@ -8,47 +33,78 @@ auto MBB<T>::intersects(const MBB &other) const -> bool {
            upperRight.getY() < other.lowerLeft.getY());
 }
 
-template <std::floating_point T>
-auto MBB<T>::intersectionArea(const MBB &other) const -> NType {
+template <Coordinate T>
+auto MBB<T>::intersectionArea(const MBB &other) const -> AreaType<T> {
   if (!intersects(other)) {
     return {0};
   }
-  NType x_overlap = std::min(upperRight.getX(), other.upperRight.getX()) -
-                    std::max(lowerLeft.getX(), other.lowerLeft.getX());
-  NType y_overlap = std::min(upperRight.getY(), other.upperRight.getY()) -
-                    std::max(lowerLeft.getY(), other.lowerLeft.getY());
-  return x_overlap * y_overlap;
+  AreaType<T> x_overlap =
+      span(std::max(lowerLeft.getX(), other.lowerLeft.getX()),
+           std::min(upperRight.getX(), other.upperRight.getX()));
+  AreaType<T> y_overlap =
+      span(std::max(lowerLeft.getY(), other.lowerLeft.getY()),
+           std::min(upperRight.getY(), other.upperRight.getY()));
+  return product<T>(x_overlap, y_overlap);
 }
 
-template <std::floating_point T> void MBB<T>::expand(const MBB &other) {
+template <Coordinate T> void MBB<T>::expand(const MBB &other) {
   lowerLeft.setX(std::min(lowerLeft.getX(), other.lowerLeft.getX()));
   lowerLeft.setY(std::min(lowerLeft.getY(), other.lowerLeft.getY()));
   upperRight.setX(std::max(upperRight.getX(), other.upperRight.getX()));
   upperRight.setY(std::max(upperRight.getY(), other.upperRight.getY()));
 }
 
-template <std::floating_point T>
-auto MBB<T>::calculateExpansionCost(const MBB &other) const -> NType {
+template <Coordinate T>
+auto MBB<T>::calculateExpansionCost(const MBB &other) const -> AreaType<T> {
   MBB expanded = *this;
   expanded.expand(other);
   return expanded.area() - this->area();
 }
 
-template <std::floating_point T>
+template <Coordinate T>
 auto MBB<T>::contains(const Point<T> &point) const -> bool {
   return (
       point.getX() >= lowerLeft.getX() && point.getX() <= upperRight.getX() &&
       point.getY() >= lowerLeft.getY() && point.getY() <= upperRight.getY());
 }
 
-template <std::floating_point T> auto MBB<T>::perimeter() const -> NType {
-  return Safe<T>{2} * ((upperRight.getX() - lowerLeft.getX()) +
-                       (upperRight.getY() - lowerLeft.getY()));
+template <Coordinate T>
+auto MBB<T>::contains(const MBB &other) const -> bool {
+  return other.lowerLeft.getX() >= lowerLeft.getX() &&
+         other.upperRight.getX() <= upperRight.getX() &&
+         other.lowerLeft.getY() >= lowerLeft.getY() &&
+         other.upperRight.getY() <= upperRight.getY();
+}
+
+template <Coordinate T> auto MBB<T>::perimeter() const -> AreaType<T> {
+  return AreaType<T>{2} * (span(lowerLeft.getX(), upperRight.getX()) +
+                           span(lowerLeft.getY(), upperRight.getY()));
+}
+
+template <Coordinate T> auto MBB<T>::area() const -> AreaType<T> {
+  return product<T>(span(lowerLeft.getX(), upperRight.getX()),
+                    span(lowerLeft.getY(), upperRight.getY()));
 }
 
-template <std::floating_point T> auto MBB<T>::area() const -> NType {
-  return (upperRight.getX() - lowerLeft.getX()) *
-         (upperRight.getY() - lowerLeft.getY());
+template <Coordinate T>
+auto MBB<T>::distanceSquared(const Point<T> &point) const -> double {
+  auto gap = [](T value, T low, T high) -> double {
+    if (value < low) {
+      return static_cast<double>(low) - static_cast<double>(value);
+    }
+    if (value > high) {
+      return static_cast<double>(value) - static_cast<double>(high);
+    }
+    return 0;
+  };
+  double dx = gap(point.getX().getValue(), lowerLeft.getX().getValue(),
+                  upperRight.getX().getValue());
+  double dy = gap(point.getY().getValue(), lowerLeft.getY().getValue(),
+                  upperRight.getY().getValue());
+  return dx * dx + dy * dy;
 }
 
 template class MBB<float>;
+template class MBB<double>;
+template class MBB<int32_t>;
+template class MBB<int64_t>;
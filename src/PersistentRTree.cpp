@@ -0,0 +1,483 @@
+#include "PersistentRTree.h"
+#include "Traversal.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace {
+// Every record is framed as [payload length][payload checksum][payload] and
+// the payload starts with one of these types
+constexpr uint8_t insertRecord = 1;
+constexpr uint8_t removeRecord = 2;
+constexpr uint8_t nodeRecord = 3;
+constexpr uint8_t commitRecord = 4;
+constexpr size_t frameSize = 2 * sizeof(uint32_t);
+constexpr size_t writeChunk = size_t{1} << 20U;
+
+auto checksum(const std::byte *data, size_t size) -> uint32_t {
+  // FNV-1a, enough to detect torn and partially written records
+  uint32_t hash = 2166136261U;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<uint32_t>(data[i]);
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+template <typename V> void put(std::vector<std::byte> &out, const V &value) {
+  size_t at = out.size();
+  out.resize(at + sizeof(V));
+  std::memcpy(out.data() + at, &value, sizeof(V));
+}
+
+auto beginRecord(std::vector<std::byte> &out) -> size_t {
+  size_t start = out.size();
+  out.resize(start + frameSize);
+  return start;
+}
+
+void endRecord(std::vector<std::byte> &out, size_t start) {
+  auto length = static_cast<uint32_t>(out.size() - start - frameSize);
+  uint32_t sum = checksum(out.data() + start + frameSize, length);
+  std::memcpy(out.data() + start, &length, sizeof(length));
+  std::memcpy(out.data() + start + sizeof(length), &sum, sizeof(sum));
+}
+
+// Reads fields of a payload whose checksum has already been verified
+class Reader {
+private:
+  const std::vector<std::byte> &data;
+  size_t position;
+  size_t end;
+
+public:
+  Reader(const std::vector<std::byte> &_data, size_t _position, size_t _end)
+      : data(_data), position(_position), end(_end) {}
+
+  template <typename V> auto get() -> V {
+    if (position + sizeof(V) > end) {
+      throw std::runtime_error("Malformed persistence record");
+    }
+    V value;
+    std::memcpy(&value, data.data() + position, sizeof(V));
+    position += sizeof(V);
+    return value;
+  }
+};
+
+// Advances `offset` past the next intact record and returns its payload
+// bounds. Returns false at the end of the data or at a torn record.
+auto nextRecord(const std::vector<std::byte> &data, size_t &offset,
+                size_t &payload, size_t &payloadEnd) -> bool {
+  if (offset + frameSize > data.size()) {
+    return false;
+  }
+  uint32_t length = 0;
+  uint32_t sum = 0;
+  std::memcpy(&length, data.data() + offset, sizeof(length));
+  std::memcpy(&sum, data.data() + offset + sizeof(length), sizeof(sum));
+  if (length == 0 || offset + frameSize + length > data.size() ||
+      checksum(data.data() + offset + frameSize, length) != sum) {
+    return false;
+  }
+  payload = offset + frameSize;
+  payloadEnd = payload + length;
+  offset = payloadEnd;
+  return true;
+}
+
+[[noreturn]] void fail(const std::string &what, const std::string &path) {
+  throw std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+auto openFile(const std::string &path, int flags) -> int {
+  int fd = ::open(path.c_str(), flags, 0644);
+  if (fd < 0) {
+    fail("Cannot open", path);
+  }
+  return fd;
+}
+
+void writeAll(int fd, const std::byte *data, size_t size) {
+  while (size > 0) {
+    ssize_t written = ::write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fail("Cannot write", "file");
+    }
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+}
+
+void syncFile(int fd) {
+  if (::fsync(fd) != 0) {
+    fail("Cannot sync", "file");
+  }
+}
+
+void truncateFile(int fd, size_t size) {
+  if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    fail("Cannot truncate", "file");
+  }
+}
+
+auto readFile(const std::string &path) -> std::vector<std::byte> {
+  std::vector<std::byte> data;
+  if (!std::filesystem::exists(path)) {
+    return data;
+  }
+  data.resize(std::filesystem::file_size(path));
+  int fd = openFile(path, O_RDONLY);
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t got = ::read(fd, data.data() + done, data.size() - done);
+    if (got <= 0) {
+      if (got < 0 && errno == EINTR) {
+        continue;
+      }
+      ::close(fd);
+      fail("Cannot read", path);
+    }
+    done += static_cast<size_t>(got);
+  }
+  ::close(fd);
+  return data;
+}
+} // namespace
+
+template <Coordinate T>
+PersistentRTree<T>::PersistentRTree(const std::string &directory,
+                                    uint minChildren, uint maxChildren,
+                                    PersistenceOptions _options)
+    : tree(minChildren, maxChildren), options(_options),
+      walPath(directory + "/wal.log"),
+      checkpointPath(directory + "/checkpoint.dat"), walFd(-1),
+      checkpointFd(-1), bufferedRecords(0),
+      lastSync(std::chrono::steady_clock::now()), lsn(0), checkpointLsn(0),
+      nextNodeId(1), checkpointSize(0), compactedSize(0),
+      opsSinceCheckpoint(0) {
+  std::filesystem::create_directories(directory);
+  // A compaction that did not reach its rename left only garbage behind
+  std::filesystem::remove(checkpointPath + ".tmp");
+  recover();
+}
+
+template <Coordinate T> PersistentRTree<T>::~PersistentRTree() {
+  try {
+    sync();
+  } catch (const std::runtime_error &) { // NOLINT(bugprone-empty-catch)
+    // Unsynced operations are lost exactly as in a crash
+  }
+  ::close(walFd);
+  ::close(checkpointFd);
+}
+
+template <Coordinate T> void PersistentRTree<T>::recover() {
+  loadCheckpoint();
+  replayLog();
+}
+
+template <Coordinate T> void PersistentRTree<T>::loadCheckpoint() {
+  std::vector<std::byte> data = readFile(checkpointPath);
+
+  // Node records only count once a commit record follows them
+  std::unordered_map<uint64_t, size_t> committed;
+  std::unordered_map<uint64_t, size_t> pending;
+  size_t offset = 0;
+  size_t payload = 0;
+  size_t payloadEnd = 0;
+  uint64_t rootId = 0;
+  while (nextRecord(data, offset, payload, payloadEnd)) {
+    Reader reader(data, payload, payloadEnd);
+    auto type = reader.get<uint8_t>();
+    if (type == nodeRecord) {
+      pending[reader.get<uint64_t>()] = payload;
+    } else if (type == commitRecord) {
+      for (const auto &[id, at] : pending) {
+        committed[id] = at;
+      }
+      pending.clear();
+      rootId = reader.get<uint64_t>();
+      checkpointLsn = reader.get<uint64_t>();
+      nextNodeId = reader.get<uint64_t>();
+      checkpointSize = offset;
+    } else {
+      break;
+    }
+  }
+  compactedSize = checkpointSize;
+  lsn = checkpointLsn;
+
+  checkpointFd = openFile(checkpointPath, O_WRONLY | O_CREAT | O_APPEND);
+  truncateFile(checkpointFd, checkpointSize);
+  if (rootId == 0) {
+    return;
+  }
+
+  // Build top-down in breadth-first order, then summarize bottom-up
+  std::vector<std::pair<uint64_t, RNode<T> *>> order = {{rootId, nullptr}};
+  std::vector<RNode<T> *> nodes;
+  for (size_t i = 0; i < order.size(); ++i) {
+    auto [id, parent] = order[i];
+    auto found = committed.find(id);
+    if (found == committed.end()) {
+      throw std::runtime_error("Checkpoint references a missing node");
+    }
+    Reader reader(data, found->second, data.size());
+    reader.get<uint8_t>();
+    reader.get<uint64_t>();
+    auto *node = new RNode<T>(reader.get<uint8_t>() != 0);
+    if (parent != nullptr) {
+      parent->children.push_back(node);
+      node->parent = parent;
+    }
+    auto entries = reader.get<uint32_t>();
+    for (uint32_t j = 0; j < entries; ++j) {
+      if (node->isLeaf) {
+        T x = reader.get<T>();
+        T y = reader.get<T>();
+        node->points.emplace_back(x, y);
+      } else {
+        order.emplace_back(reader.get<uint64_t>(), node);
+      }
+    }
+    nodes.push_back(node);
+  }
+  for (size_t i = nodes.size(); i-- > 0;) {
+    nodes[i]->updateBoundingBox(tree.params);
+    nodes[i]->diskId = order[i].first;
+  }
+
+  RNode<T>::release(tree.root);
+  tree.root = nodes.front();
+}
+
+template <Coordinate T> void PersistentRTree<T>::replayLog() {
+  std::vector<std::byte> data = readFile(walPath);
+  size_t offset = 0;
+  size_t validEnd = 0;
+  size_t payload = 0;
+  size_t payloadEnd = 0;
+  while (nextRecord(data, offset, payload, payloadEnd)) {
+    Reader reader(data, payload, payloadEnd);
+    auto type = reader.get<uint8_t>();
+    auto recordLsn = reader.get<uint64_t>();
+    T x = reader.get<T>();
+    T y = reader.get<T>();
+    if (type != insertRecord && type != removeRecord) {
+      break;
+    }
+    validEnd = offset;
+    // Records already covered by the checkpoint are skipped
+    if (recordLsn <= checkpointLsn) {
+      continue;
+    }
+    if (type == insertRecord) {
+      tree.insert(Point<T>(x, y));
+    } else {
+      tree.remove(Point<T>(x, y));
+    }
+    lsn = recordLsn;
+    ++opsSinceCheckpoint;
+  }
+
+  walFd = openFile(walPath, O_WRONLY | O_CREAT | O_APPEND);
+  truncateFile(walFd, validEnd);
+}
+
+template <Coordinate T>
+void PersistentRTree<T>::log(uint8_t op, const Point<T> &point) {
+  size_t start = beginRecord(walBuffer);
+  put(walBuffer, op);
+  put(walBuffer, ++lsn);
+  put(walBuffer, point.getX().getValue());
+  put(walBuffer, point.getY().getValue());
+  endRecord(walBuffer, start);
+
+  if (++bufferedRecords >= options.groupCommitSize ||
+      std::chrono::steady_clock::now() - lastSync >=
+          options.groupCommitInterval) {
+    sync();
+  }
+}
+
+template <Coordinate T> void PersistentRTree<T>::insert(const Point<T> &point) {
+  log(insertRecord, point);
+  tree.insert(point);
+  if (options.checkpointInterval != 0 &&
+      ++opsSinceCheckpoint >= options.checkpointInterval) {
+    checkpoint();
+  }
+}
+
+template <Coordinate T> void PersistentRTree<T>::remove(const Point<T> &point) {
+  log(removeRecord, point);
+  tree.remove(point);
+  if (options.checkpointInterval != 0 &&
+      ++opsSinceCheckpoint >= options.checkpointInterval) {
+    checkpoint();
+  }
+}
+
+template <Coordinate T> void PersistentRTree<T>::sync() {
+  lastSync = std::chrono::steady_clock::now();
+  if (walBuffer.empty()) {
+    return;
+  }
+  writeAll(walFd, walBuffer.data(), walBuffer.size());
+  syncFile(walFd);
+  walBuffer.clear();
+  bufferedRecords = 0;
+}
+
+template <Coordinate T>
+void PersistentRTree<T>::writeNodes(int fd, bool everything, size_t &written) {
+  // Post-order, so children have their ids before the parent refers to them.
+  // Clean subtrees are skipped unless everything is rewritten.
+  std::vector<std::byte> out;
+  SmallStack<std::pair<RNode<T> *, bool>> pending;
+  pending.push({tree.root, false});
+  while (!pending.empty()) {
+    auto [node, childrenDone] = pending.pop();
+    if (!childrenDone) {
+      if (everything || node->diskId == 0) {
+        pending.push({node, true});
+        for (auto *child : node->children) {
+          pending.push({child, false});
+        }
+      }
+      continue;
+    }
+
+    node->diskId = nextNodeId++;
+    size_t start = beginRecord(out);
+    put(out, nodeRecord);
+    put(out, node->diskId);
+    put(out, static_cast<uint8_t>(node->isLeaf ? 1 : 0));
+    if (node->isLeaf) {
+      put(out, static_cast<uint32_t>(node->points.size()));
+      for (const auto &point : node->points) {
+        put(out, point.getX().getValue());
+        put(out, point.getY().getValue());
+      }
+    } else {
+      put(out, static_cast<uint32_t>(node->children.size()));
+      for (const auto *child : node->children) {
+        put(out, child->diskId);
+      }
+    }
+    endRecord(out, start);
+
+    if (out.size() >= writeChunk) {
+      writeAll(fd, out.data(), out.size());
+      written += out.size();
+      out.clear();
+    }
+  }
+
+  size_t start = beginRecord(out);
+  put(out, commitRecord);
+  put(out, tree.root->diskId);
+  put(out, lsn);
+  put(out, nextNodeId);
+  endRecord(out, start);
+  writeAll(fd, out.data(), out.size());
+  written += out.size();
+  syncFile(fd);
+}
+
+template <Coordinate T> void PersistentRTree<T>::forgetDiskIds() {
+  // The next checkpoint writes every node again
+  SmallStack<RNode<T> *> pending;
+  pending.push(tree.root);
+  while (!pending.empty()) {
+    RNode<T> *node = pending.pop();
+    node->diskId = 0;
+    for (auto *child : node->children) {
+      pending.push(child);
+    }
+  }
+}
+
+template <Coordinate T> void PersistentRTree<T>::checkpoint() {
+  sync();
+  size_t written = 0;
+  try {
+    writeNodes(checkpointFd, false, written);
+  } catch (const std::runtime_error &) {
+    // Nodes may hold ids whose records never reached a commit, and a torn
+    // record would hide every later commit from recovery
+    forgetDiskIds();
+    truncateFile(checkpointFd, checkpointSize);
+    throw;
+  }
+  checkpointSize += written;
+  checkpointLsn = lsn;
+  opsSinceCheckpoint = 0;
+
+  // Everything in the log is now covered by the checkpoint
+  truncateFile(walFd, 0);
+  syncFile(walFd);
+
+  if (compactedSize == 0) {
+    compactedSize = checkpointSize;
+  } else if (checkpointSize > options.compactionRatio * compactedSize) {
+    compact();
+  }
+}
+
+template <Coordinate T> void PersistentRTree<T>::compact() {
+  // Rewrite every live node into a fresh file and swap it in atomically
+  std::string temporary = checkpointPath + ".tmp";
+  int fd = openFile(temporary, O_WRONLY | O_CREAT | O_TRUNC);
+  size_t written = 0;
+  uint64_t firstUnusedId = nextNodeId;
+  nextNodeId = 1;
+  try {
+    writeNodes(fd, true, written);
+    ::close(fd);
+    fd = -1;
+    std::filesystem::rename(temporary, checkpointPath);
+    int directory = openFile(
+        std::filesystem::path(checkpointPath).parent_path().string(),
+        O_RDONLY);
+    try {
+      syncFile(directory);
+    } catch (const std::runtime_error &) {
+      ::close(directory);
+      throw;
+    }
+    ::close(directory);
+  } catch (const std::runtime_error &) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    std::error_code ignored;
+    std::filesystem::remove(temporary, ignored);
+    // Ids now follow the new file's numbering, which the file at
+    // checkpointPath may not use. The next checkpoint rewrites every node
+    // past the old ids into whichever file the path names now.
+    forgetDiskIds();
+    nextNodeId = firstUnusedId;
+    ::close(checkpointFd);
+    checkpointFd = openFile(checkpointPath, O_WRONLY | O_APPEND);
+    checkpointSize = std::filesystem::file_size(checkpointPath);
+    throw;
+  }
+
+  ::close(checkpointFd);
+  checkpointFd = openFile(checkpointPath, O_WRONLY | O_APPEND);
+  checkpointSize = written;
+  compactedSize = written;
+}
+
+template class PersistentRTree<float>;
+template class PersistentRTree<double>;
+template class PersistentRTree<int32_t>;
+template class PersistentRTree<int64_t>;
@@ -1,32 +1,125 @@
 #include "Rtree.h"
+#include "Traversal.h"
 #include <algorithm>
 #include <optional>
+#include <queue>
 
-using std::cout;
 using std::optional;
 using std::pair;
 
-template <std::floating_point T> RNode<T>::~RNode() {
+template <Coordinate T> RNode<T>::~RNode() {
 
   if (isLeaf) {
     return;
   }
   for (auto child : children) {
 
-    delete child;
+    release(child);
   }
 }
 
-template <std::floating_point T>
+template <Coordinate T> void RNode<T>::destroy(RNode<T> *node) {
+  Block *owner = node->block;
+  if (owner == nullptr) {
+    delete node;
+    return;
+  }
+  node->~RNode();
+  if (owner->live.fetch_sub(1) == 1) {
+    owner->~Block();
+    ::operator delete(static_cast<void *>(owner));
+  }
+}
+
+template <Coordinate T> void RNode<T>::release(RNode<T> *node) {
+  if (node->refs.fetch_sub(1) == 1) {
+    destroy(node);
+  }
+}
+
+template <Coordinate T>
+auto RNode<T>::shallowCopy() const -> RNode<T> * {
+  auto *copy = new RNode<T>(isLeaf);
+  copy->boundingBox = boundingBox;
+  copy->points = points;
+  copy->children = children;
+  copy->subtreeCount = subtreeCount;
+  copy->subtreeAggregate = subtreeAggregate;
+  for (auto *child : children) {
+    child->refs.fetch_add(1);
+  }
+  return copy;
+}
+
+template <Coordinate T>
+auto RNode<T>::exclusiveChild(RNode<T> *child) -> RNode<T> * {
+  // Shared children are copied before a write goes through them. Parent
+  // pointers are only trusted on such exclusive write paths, so they are
+  // refreshed here.
+  if (child->refs.load() > 1) {
+    RNode *copy = child->shallowCopy();
+    std::replace(children.begin(), children.end(), child, copy);
+    release(child);
+    child = copy;
+  }
+  child->parent = this;
+  return child;
+}
+
+template <Coordinate T>
+auto RNode<T>::cloneTree(const RNode<T> *root) -> RNode<T> * {
+  // Breadth-first order keeps the children of every node adjacent
+  std::vector<const RNode *> order = {root};
+  for (size_t i = 0; i < order.size(); ++i) {
+    for (const auto *child : order[i]->children) {
+      order.push_back(child);
+    }
+  }
+
+  constexpr size_t header =
+      (sizeof(Block) + alignof(RNode) - 1) / alignof(RNode) * alignof(RNode);
+  auto *memory = static_cast<std::byte *>(
+      ::operator new(header + order.size() * sizeof(RNode)));
+  auto *owner = new (memory) Block{order.size()};
+
+  std::vector<RNode *> copies(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    const RNode *source = order[i];
+    void *slot = memory + header + i * sizeof(RNode);
+    auto *copy = new (slot) RNode(source->isLeaf);
+    copy->block = owner;
+    copy->boundingBox = source->boundingBox;
+    copy->points.reserve(source->points.size());
+    copy->points.assign(source->points.begin(), source->points.end());
+    copy->children.reserve(source->children.size());
+    copy->subtreeCount = source->subtreeCount;
+    copy->subtreeAggregate = source->subtreeAggregate;
+    copies[i] = copy;
+  }
+
+  size_t next = 1;
+  for (size_t i = 0; i < order.size(); ++i) {
+    for (size_t j = 0; j < order[i]->children.size(); ++j, ++next) {
+      copies[i]->children.push_back(copies[next]);
+      copies[next]->parent = copies[i];
+    }
+  }
+  return copies.front();
+}
+
+template <Coordinate T>
 auto RNode<T>::chooseSubtree(const Point<T> &point) -> RNode<T> * {
   // Choose the subtree that requires the least expansion to include the new
-  // point
-  RNode *bestChild = nullptr;
-  NType leastExpansion = std::numeric_limits<float>::max();
+  // point. Saturated integral costs may all be equal, so start from the first
+  // child rather than from a sentinel cost none of them might beat.
+  MBB<T> target(point, point);
+  RNode *bestChild = children.front();
+  AreaType<T> leastExpansion =
+      bestChild->boundingBox.calculateExpansionCost(target);
 
   for (auto child : children) {
-    NType expansionCost =
-        child->boundingBox.calculateExpansionCost(MBB<T>(point, point));
+    AreaType<T> expansionCost =
+        child->boundingBox.calculateExpansionCost(target);
     if (expansionCost < leastExpansion) {
       leastExpansion = expansionCost;
       bestChild = child;
@@ -35,12 +128,14 @@ auto RNode<T>::chooseSubtree(const Point<T> &point) -> RNode<T> * {
   return bestChild;
 }
 
-template <std::floating_point T>
-auto RNode<T>::split() -> std::pair<RNode<T> *, RNode<T> *> {
+template <Coordinate T>
+auto RNode<T>::split(const TreeParams<T> &params)
+    -> std::pair<RNode<T> *, RNode<T> *> {
+  const size_t minChildren = params.minChildren;
 
   // Create two new nodes
-  auto *newNode1 = new RNode<T>(minChildren, maxChildren, isLeaf);
-  auto *newNode2 = new RNode<T>(minChildren, maxChildren, isLeaf);
+  auto *newNode1 = new RNode<T>(isLeaf);
+  auto *newNode2 = new RNode<T>(isLeaf);
 
   // Set the parent of the new nodes
   newNode1->parent = this->parent;
@@ -55,17 +150,11 @@ auto RNode<T>::split() -> std::pair<RNode<T> *, RNode<T> *> {
     newNode1->points.push_back(seeds.first);
     newNode2->points.push_back(seeds.second);
 
-    std::cout << "pre-seeding points: " << points.size() << "\n";
-
-    // remove seeds from points
+    // remove seeds from points, keeping duplicates of the seeds
     this->points.erase(
-        std::remove(this->points.begin(), this->points.end(), seeds.first),
-        this->points.end());
+        std::find(this->points.begin(), this->points.end(), seeds.first));
     this->points.erase(
-        std::remove(this->points.begin(), this->points.end(), seeds.second),
-        this->points.end());
-
-    std::cout << "Remaining points: " << points.size() << "\n";
+        std::find(this->points.begin(), this->points.end(), seeds.second));
 
     // Distribute the remaining points
     while (!points.empty()) {
@@ -93,9 +182,6 @@ auto RNode<T>::split() -> std::pair<RNode<T> *, RNode<T> *> {
     }
   } else {
 
-    std::cout << "Splitting internal node with " << children.size()
-              << " entries\n";
-
     // Inner node splitting
     std::pair<RNode<T> *, RNode<T> *> seeds = pickInternalSeedsQuadratic();
 
@@ -136,45 +222,44 @@ auto RNode<T>::split() -> std::pair<RNode<T> *, RNode<T> *> {
     }
   }
 
-  // Update bounding boxes
-  updateBoundingBox();
-  newNode1->updateBoundingBox();
-  newNode2->updateBoundingBox();
-
-  // Optionally print debug information
-  std::cout << "Splitting into: "
-            << (isLeaf ? newNode1->points.size() : newNode1->children.size())
-            << " and "
-            << (isLeaf ? newNode2->points.size() : newNode2->children.size())
-            << " entries\n";
-  if (isLeaf) {
-    cout << "Leaf node split\n";
-    for (const auto &point : newNode1->points) {
-      std::cout << "Point: " << point << '\n';
+  // Children moved to the new nodes must not point back to this node.
+  // Shared children are left alone, their parent is set when copied.
+  if (!isLeaf) {
+    for (auto *child : newNode1->children) {
+      if (child->refs.load() == 1) {
+        child->parent = newNode1;
+      }
     }
-    cout << "Right node split\n";
-    for (const auto &point : newNode2->points) {
-      std::cout << "Point: " << point << '\n';
+    for (auto *child : newNode2->children) {
+      if (child->refs.load() == 1) {
+        child->parent = newNode2;
+      }
     }
   }
-  delete this;
+
+  // Update bounding boxes
+  updateBoundingBox(params);
+  newNode1->updateBoundingBox(params);
+  newNode2->updateBoundingBox(params);
+
+  destroy(this);
   return {newNode1, newNode2};
 }
 
-template <std::floating_point T>
+template <Coordinate T>
 auto RNode<T>::pickInternalSeedsQuadratic()
     -> std::pair<RNode<T> *, RNode<T> *> {
 
   return {children[0], children[1]};
 
-  NType maxWastedArea = -1;
+  AreaType<T> maxWastedArea = -1;
   std::pair<RNode<T> *, RNode<T> *> seeds = {nullptr, nullptr};
 
   for (size_t i = 0; i < children.size() - 1; ++i) {
     for (size_t j = i + 1; j < children.size(); ++j) {
       MBB<T> m = children.at(i)->boundingBox;
       m.expand(children[j]->boundingBox);
-      NType wastedArea = m.area() - (children[i]->boundingBox.area() +
+      AreaType<T> wastedArea = m.area() - (children[i]->boundingBox.area() +
                                      children[j]->boundingBox.area());
 
       if (wastedArea > maxWastedArea) {
@@ -186,14 +271,15 @@ auto RNode<T>::pickInternalSeedsQuadratic()
 
   return seeds;
 }
-template <std::floating_point T>
+template <Coordinate T>
 auto RNode<T>::pickSeedsQuadratic() -> std::pair<Point<T>, Point<T>> {
-  NType maxWastedArea = -1;
-  std::pair<Point<T>, Point<T>> seeds;
+  AreaType<T> maxWastedArea = -1;
+  std::pair<Point<T>, Point<T>> seeds = {points[0], points[1]};
 
   for (size_t i = 0; i < points.size() - 1; ++i) {
     for (size_t j = i + 1; j < points.size(); ++j) {
-      MBB<T> m(points[i], points[j]);
+      MBB<T> m(points[i], points[i]);
+      m.expand(MBB<T>(points[j], points[j]));
       if (m.area() > maxWastedArea) {
         maxWastedArea = m.area();
         seeds = std::make_pair(points[i], points[j]);
@@ -204,7 +290,37 @@ auto RNode<T>::pickSeedsQuadratic() -> std::pair<Point<T>, Point<T>> {
   return seeds;
 }
 
-template <std::floating_point T> void RNode<T>::updateBoundingBox() {
+template <Coordinate T>
+void RNode<T>::updateAggregate(const TreeParams<T> &params) {
+  const Monoid<T> *monoid = params.monoid;
+  if (isLeaf) {
+    subtreeCount = points.size();
+    if (monoid != nullptr) {
+      subtreeAggregate = monoid->identity;
+      for (const auto &point : points) {
+        subtreeAggregate =
+            monoid->combine(subtreeAggregate, monoid->lift(point));
+      }
+    }
+  } else {
+    subtreeCount = 0;
+    for (const auto *child : children) {
+      subtreeCount += child->subtreeCount;
+    }
+    if (monoid != nullptr) {
+      subtreeAggregate = monoid->identity;
+      for (const auto *child : children) {
+        subtreeAggregate =
+            monoid->combine(subtreeAggregate, child->subtreeAggregate);
+      }
+    }
+  }
+}
+
+template <Coordinate T>
+void RNode<T>::updateBoundingBox(const TreeParams<T> &params) {
+  diskId = 0;
+  updateAggregate(params);
   if (isLeaf) {
     if (points.empty()) {
       return;
@@ -224,42 +340,96 @@ template <std::floating_point T> void RNode<T>::updateBoundingBox() {
   }
 }
 
-template <std::floating_point T>
-auto RNode<T>::search(const Point<T> &point) -> bool {
+template <Coordinate T> void RNode<T>::prefetchEntries() const {
   if (isLeaf) {
-
-    return std::find(points.begin(), points.end(), point) != points.end();
+    prefetch(points.data());
   } else {
-    for (auto child : children) {
-      if (child->boundingBox.contains(point)) {
+    prefetch(children.data());
+  }
+}
 
-        if (child->search(point)) {
-          return true;
-        }
+template <Coordinate T>
+auto RNode<T>::search(const Point<T> &point) -> bool {
+  SmallStack<const RNode *> pending;
+  pending.push(this);
+  while (!pending.empty()) {
+    const RNode *node = pending.pop();
+    if (node->isLeaf) {
+      if (std::find(node->points.begin(), node->points.end(), point) !=
+          node->points.end()) {
+        return true;
+      }
+      continue;
+    }
+    for (auto it = node->children.rbegin(); it != node->children.rend();
+         ++it) {
+      if ((*it)->boundingBox.contains(point)) {
+        (*it)->prefetchEntries();
+        pending.push(*it);
       }
     }
   }
   return false;
 }
 
-template <std::floating_point T>
-auto RNode<T>::insert(const Point<T> &point)
+template <Coordinate T>
+auto RNode<T>::searchLookups(const RNode *root,
+                             const std::vector<Point<T>> &points,
+                             size_t &next, std::vector<bool> &found)
+    -> Interleaved {
+  SmallStack<const RNode *> pending;
+  while (next < points.size()) {
+    size_t index = next++;
+    const Point<T> &point = points[index];
+    pending.push(root);
+    while (!pending.empty()) {
+      const RNode *node = pending.pop();
+      // Nodes are pushed with their header prefetched; their entries are
+      // the next miss
+      node->prefetchEntries();
+      co_await std::suspend_always{};
+      if (node->isLeaf) {
+        if (std::find(node->points.begin(), node->points.end(), point) !=
+            node->points.end()) {
+          found[index] = true;
+          break;
+        }
+        continue;
+      }
+      // Every child's box is read below, so all their headers are loaded
+      for (const auto *child : node->children) {
+        prefetch(child);
+      }
+      co_await std::suspend_always{};
+      for (auto it = node->children.rbegin(); it != node->children.rend();
+           ++it) {
+        if ((*it)->boundingBox.contains(point)) {
+          pending.push(*it);
+        }
+      }
+    }
+    pending.clear();
+  }
+}
+
+template <Coordinate T>
+auto RNode<T>::insert(const Point<T> &point, const TreeParams<T> &params)
     -> optional<pair<RNode<T> *, RNode<T> *>> {
 
   if (isLeaf) {
 
     points.push_back(point);
-    updateBoundingBox();
-    if (points.size() > maxChildren) {
-      return split();
+    updateBoundingBox(params);
+    if (points.size() > params.maxChildren) {
+      return split(params);
     }
     return std::nullopt;
   } else {
 
-    RNode *child = chooseSubtree(point);
+    RNode *child = exclusiveChild(chooseSubtree(point));
 
     // handle overflow
-    auto newChildren = child->insert(point);
+    auto newChildren = child->insert(point, params);
 
     if (newChildren.has_value()) {
       this->children.erase(
@@ -268,82 +438,192 @@ auto RNode<T>::insert(const Point<T> &point)
 
       this->children.push_back(newChildren->first);
       this->children.push_back(newChildren->second);
-      if (this->children.size() > maxChildren) {
-        return split();
+      if (this->children.size() > params.maxChildren) {
+        return split(params);
       }
     }
-    updateBoundingBox();
+    updateBoundingBox(params);
     return std::nullopt;
   }
 }
 
-template <std::floating_point T>
+template <Coordinate T>
 auto RNode<T>::query(const QueryBox<T> &q) -> std::vector<Point<T>> {
   std::vector<Point<T>> result;
-  if (isLeaf) {
-    for (const auto &point : points) {
-      if (q.contains(point)) {
-        result.push_back(point);
+  SmallStack<const RNode *> pending;
+  pending.push(this);
+  while (!pending.empty()) {
+    const RNode *node = pending.pop();
+    if (node->isLeaf) {
+      for (const auto &point : node->points) {
+        if (q.contains(point)) {
+          result.push_back(point);
+        }
       }
+      continue;
     }
-  } else {
-    for (const auto &child : children) {
-      if (q.intersects(child->boundingBox)) {
-        auto childResult = child->query(q);
-        result.insert(result.end(), childResult.begin(), childResult.end());
+    for (auto it = node->children.rbegin(); it != node->children.rend();
+         ++it) {
+      if (q.intersects((*it)->boundingBox)) {
+        (*it)->prefetchEntries();
+        pending.push(*it);
       }
     }
   }
   return result;
 }
 
-template <std::floating_point T>
-auto RNode<T>::findLeaf(const Point<T> &point) -> RNode<T> * {
-  if (isLeaf) {
-    auto it = std::find(points.begin(), points.end(), point);
-    if (it != points.end()) {
-      return this;
+template <Coordinate T>
+auto RNode<T>::count(const QueryBox<T> &q) const -> size_t {
+  size_t result = 0;
+  SmallStack<const RNode *> pending;
+  pending.push(this);
+  while (!pending.empty()) {
+    const RNode *node = pending.pop();
+    // Whole subtrees inside the query are answered from the augmented count
+    if (q.contains(node->boundingBox)) {
+      result += node->subtreeCount;
+    } else if (node->isLeaf) {
+      for (const auto &point : node->points) {
+        if (q.contains(point)) {
+          ++result;
+        }
+      }
+    } else {
+      for (const auto *child : node->children) {
+        if (q.intersects(child->boundingBox)) {
+          child->prefetchEntries();
+          pending.push(child);
+        }
+      }
     }
-  } else {
-    for (auto child : children) {
-      if (child->boundingBox.contains(point)) {
-        RNode *leaf = child->findLeaf(point);
-        if (leaf != nullptr) {
-          return leaf;
+  }
+  return result;
+}
+
+template <Coordinate T>
+auto RNode<T>::aggregate(const QueryBox<T> &q, const Monoid<T> &monoid) const
+    -> Safe<T> {
+  Safe<T> result = monoid.identity;
+  SmallStack<const RNode *> pending;
+  pending.push(this);
+  while (!pending.empty()) {
+    const RNode *node = pending.pop();
+    if (q.contains(node->boundingBox)) {
+      result = monoid.combine(result, node->subtreeAggregate);
+    } else if (node->isLeaf) {
+      for (const auto &point : node->points) {
+        if (q.contains(point)) {
+          result = monoid.combine(result, monoid.lift(point));
+        }
+      }
+    } else {
+      for (const auto *child : node->children) {
+        if (q.intersects(child->boundingBox)) {
+          child->prefetchEntries();
+          pending.push(child);
         }
       }
     }
   }
+  return result;
+}
+
+template <Coordinate T>
+auto RNode<T>::knn(const Point<T> &point, size_t k) const
+    -> std::vector<Point<T>> {
+  // Best-first search: nodes and points share one queue ordered by their
+  // distance, so a point popped from it is closer than anything left
+  struct Entry {
+    double distance;
+    const RNode *node; // nullptr for a stored point
+    Point<T> point;
+    auto operator>(const Entry &other) const -> bool {
+      return distance > other.distance;
+    }
+  };
+  std::vector<Point<T>> result;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<>> pending;
+  pending.push({boundingBox.distanceSquared(point), this, {}});
+  while (!pending.empty() && result.size() < k) {
+    Entry entry = pending.top();
+    pending.pop();
+    if (entry.node == nullptr) {
+      result.push_back(entry.point);
+    } else if (entry.node->isLeaf) {
+      for (const auto &stored : entry.node->points) {
+        pending.push({MBB<T>(stored, stored).distanceSquared(point), nullptr,
+                      stored});
+      }
+    } else {
+      for (const auto *child : entry.node->children) {
+        pending.push({child->boundingBox.distanceSquared(point), child, {}});
+      }
+    }
+  }
+  return result;
+}
+
+template <Coordinate T>
+auto RNode<T>::findLeaf(const Point<T> &point, std::vector<RNode<T> *> &path)
+    -> RNode<T> * {
+  // `path` ends up holding the nodes from this one down to the leaf
+  SmallStack<std::pair<RNode *, size_t>> pending;
+  pending.push({this, 0});
+  while (!pending.empty()) {
+    auto [node, depth] = pending.pop();
+    path.resize(depth);
+    path.push_back(node);
+    if (node->isLeaf) {
+      if (std::find(node->points.begin(), node->points.end(), point) !=
+          node->points.end()) {
+        return node;
+      }
+      continue;
+    }
+    for (auto it = node->children.rbegin(); it != node->children.rend();
+         ++it) {
+      if ((*it)->boundingBox.contains(point)) {
+        (*it)->prefetchEntries();
+        pending.push({*it, depth + 1});
+      }
+    }
+  }
+  path.clear();
   return nullptr;
 }
 
-template <std::floating_point T>
+template <Coordinate T>
 void RNode<T>::remove(const Point<T> &point,
-                      std::vector<RNode<T> *> &eliminated) {
-  RNode *leaf = findLeaf(point);
+                      std::vector<RNode<T> *> &eliminated,
+                      const TreeParams<T> &params) {
+  std::vector<RNode *> path;
+  RNode *leaf = findLeaf(point, path);
   if (leaf != nullptr) {
+    // Copy any shared node on the way down before modifying it
+    for (size_t i = 1; i < path.size(); ++i) {
+      path[i] = path[i - 1]->exclusiveChild(path[i]);
+    }
+    leaf = path.back();
 
+    // Only one copy goes, duplicates are common on integral grids
     leaf->points.erase(
-        std::remove(leaf->points.begin(), leaf->points.end(), point),
-        leaf->points.end());
+        std::find(leaf->points.begin(), leaf->points.end(), point));
 
-    leaf->updateBoundingBox();
-    if (leaf->points.size() < minChildren) {
-      condenseTree(leaf, eliminated);
-    } else {
-      adjustTree(leaf, eliminated);
-    }
+    condenseTree(leaf, eliminated, params);
   }
 }
 
-template <std::floating_point T>
-void RNode<T>::adjustTree(RNode<T> *n, std::vector<RNode<T> *> &eliminated) {
+template <Coordinate T>
+void RNode<T>::adjustTree(RNode<T> *n, std::vector<RNode<T> *> &eliminated,
+                          const TreeParams<T> &params) {
   while (n != nullptr) {
-    n->updateBoundingBox();
+    n->updateBoundingBox(params);
     if (n->parent == nullptr) {
       break;
     }
-    if (n->points.size() < minChildren || n->children.size() < minChildren) {
+    size_t entries = n->isLeaf ? n->points.size() : n->children.size();
+    if (entries < params.minChildren) {
       eliminated.push_back(n);
 
       n->parent->children.erase(std::remove(n->parent->children.begin(),
@@ -354,39 +634,53 @@ void RNode<T>::adjustTree(RNode<T> *n, std::vector<RNode<T> *> &eliminated) {
   }
 }
 
-template <std::floating_point T>
-void RNode<T>::condenseTree(RNode<T> *n, std::vector<RNode<T> *> &eliminated) {
-  adjustTree(n, eliminated);
-  for (auto node : eliminated) {
-    if (node->isLeaf) {
-      for (const auto &point : node->points) {
-        insert(point);
-      }
-    } else {
-      for (auto child : node->children) {
-        children.push_back(child);
-        child->parent = this;
-      }
+template <Coordinate T>
+void RNode<T>::condenseTree(RNode<T> *n, std::vector<RNode<T> *> &eliminated,
+                            const TreeParams<T> &params) {
+  // Underfull nodes are detached on the way up. Their entries are reinserted
+  // by RTree::remove, since a reinsertion may split the root.
+  adjustTree(n, eliminated, params);
+}
+
+template <Coordinate T> auto RNode<T>::memoryUsage() const -> size_t {
+  size_t bytes = 0;
+  SmallStack<const RNode *> pending;
+  pending.push(this);
+  while (!pending.empty()) {
+    const RNode *node = pending.pop();
+    bytes += sizeof(RNode) + node->points.capacity() * sizeof(Point<T>) +
+             node->children.capacity() * sizeof(RNode *);
+    for (const auto *child : node->children) {
+      pending.push(child);
     }
-    delete node;
   }
+  return bytes;
 }
 
-template <std::floating_point T> void RNode<T>::print(size_t depth) const {
+template <Coordinate T> void RNode<T>::print(size_t depth) const {
+  SmallStack<std::pair<const RNode *, size_t>> pending;
+  pending.push({this, depth});
+  while (!pending.empty()) {
+    auto [node, level] = pending.pop();
 
-  std::string indent(depth * 2, ' ');
-  std::cout << indent << "Node at depth " << depth
-            << (isLeaf ? " (Leaf)" : " (Internal)") << '\n';
+    std::string indent(level * 2, ' ');
+    std::cout << indent << "Node at depth " << level
+              << (node->isLeaf ? " (Leaf)" : " (Internal)") << '\n';
 
-  if (isLeaf) {
-    for (const auto &point : getPoints()) {
-      std::cout << indent << "  Point: " << point << std::endl;
-    }
-  } else {
-    for (const auto &child : getChildren()) {
-      child->print(depth + 1);
+    if (node->isLeaf) {
+      for (const auto &point : node->points) {
+        std::cout << indent << "  Point: " << point << std::endl;
+      }
+    } else {
+      for (auto it = node->children.rbegin(); it != node->children.rend();
+           ++it) {
+        pending.push({*it, level + 1});
+      }
     }
   }
 }
 
 template class RNode<float>;
+template class RNode<double>;
+template class RNode<int32_t>;
+template class RNode<int64_t>;
@@ -1,46 +1,328 @@
 #include "Rtree.h"
+#include "Traversal.h"
+#include <algorithm>
+#include <cmath>
 
-template <std::floating_point T>
+namespace {
+// Sort-Tile-Recursive order for bulk loading. Entries are grouped into
+// nodes of at most `capacity`; the groups are laid out in vertical slices
+// of about sqrt(groups) nodes, sorted by x across slices and by y within
+// one. Returns the group sizes, which differ by at most one so no group
+// falls below half the capacity.
+template <typename E, typename Center>
+auto sortTileRecursive(std::vector<E> &entries, size_t capacity,
+                       Center center) -> std::vector<size_t> {
+  size_t groups = (entries.size() + capacity - 1) / capacity;
+  std::vector<size_t> sizes(groups, entries.size() / groups);
+  for (size_t i = 0; i < entries.size() % groups; ++i) {
+    ++sizes[i];
+  }
+
+  std::sort(entries.begin(), entries.end(), [&](const E &a, const E &b) {
+    return center(a).first < center(b).first;
+  });
+  auto perSlice = static_cast<size_t>(
+      std::ceil(std::sqrt(static_cast<double>(groups))));
+  size_t begin = 0;
+  for (size_t group = 0; group < groups; group += perSlice) {
+    size_t end = begin;
+    for (size_t i = group; i < std::min(group + perSlice, groups); ++i) {
+      end += sizes[i];
+    }
+    std::sort(entries.begin() + static_cast<std::ptrdiff_t>(begin),
+              entries.begin() + static_cast<std::ptrdiff_t>(end),
+              [&](const E &a, const E &b) {
+                return center(a).second < center(b).second;
+              });
+    begin = end;
+  }
+  return sizes;
+}
+} // namespace
+
+template <Coordinate T>
 auto RTree<T>::search(const Point<T> &point) -> bool {
 
   return root->search(point);
 }
 
-template <std::floating_point T> void RTree<T>::insert(const Point<T> &point) {
+template <Coordinate T>
+auto RTree<T>::searchBatch(const std::vector<Point<T>> &points,
+                           size_t inFlight) const -> std::vector<bool> {
+  std::vector<bool> found(points.size(), false);
+  size_t next = 0;
+  std::vector<Interleaved> lookups;
+  for (size_t i = 0; i < std::max<size_t>(inFlight, 1); ++i) {
+    lookups.push_back(RNode<T>::searchLookups(root, points, next, found));
+  }
+  interleave(lookups);
+  return found;
+}
+
+template <Coordinate T> void RTree<T>::makeRootExclusive() {
+  if (root->refs.load() > 1) {
+    RNode<T> *copy = root->shallowCopy();
+    RNode<T>::release(root);
+    root = copy;
+  }
+}
 
-  auto newNodes = root->insert(point);
+template <Coordinate T> void RTree<T>::insert(const Point<T> &point) {
+
+  makeRootExclusive();
+  auto newNodes = root->insert(point, params);
 
   if (newNodes.has_value()) {
     // root was split
-        std::cout << "Root was split\n";
-
-
-    auto *newRoot = new RNode<T>(minChildren, maxChildren, false);
+    auto *newRoot = new RNode<T>(false);
     newRoot->children.push_back(newNodes.value().first);
     newRoot->children.push_back(newNodes.value().second);
 
     newNodes.value().first->parent = newRoot;
     newNodes.value().second->parent = newRoot;
 
-    newRoot->updateBoundingBox();
+    newRoot->updateBoundingBox(params);
 
     root = newRoot;
   }
 }
 
-template <std::floating_point T> void RTree<T>::remove(const Point<T> &point) {
+template <Coordinate T> void RTree<T>::remove(const Point<T> &point) {
 
+  makeRootExclusive();
   std::vector<RNode<T> *> removed;
-  root->remove(point, removed);
+  root->remove(point, removed, params);
+
+  std::vector<Point<T>> orphans;
+  for (auto *node : removed) {
+    collectPoints(node, orphans);
+    RNode<T>::release(node);
+  }
+
+  // Shorten the tree while the root is an internal node with a single child
+  while (!root->isLeaf && root->children.size() <= 1) {
+    RNode<T> *newRoot = nullptr;
+    if (root->children.empty()) {
+      newRoot = new RNode<T>(true);
+      newRoot->updateBoundingBox(params);
+    } else {
+      newRoot = root->exclusiveChild(root->children.front());
+      root->children.clear();
+      newRoot->parent = nullptr;
+    }
+    RNode<T>::release(root);
+    root = newRoot;
+  }
+
+  for (const auto &orphan : orphans) {
+    insert(orphan);
+  }
 }
 
-template <std::floating_point T>
+template <Coordinate T>
+void RTree<T>::refreshPath(const std::vector<RNode<T> *> &path, size_t from) {
+  for (size_t i = from + 1; i-- > 0;) {
+    path[i]->updateBoundingBox(params);
+  }
+}
+
+template <Coordinate T>
+auto RTree<T>::update(const Point<T> &from, const Point<T> &to, T tolerance)
+    -> bool {
+  makeRootExclusive();
+  std::vector<RNode<T> *> path;
+  if (root->findLeaf(from, path) == nullptr) {
+    return false;
+  }
+  // Copy any shared node on the way down before modifying it
+  for (size_t i = 1; i < path.size(); ++i) {
+    path[i] = path[i - 1]->exclusiveChild(path[i]);
+  }
+  RNode<T> *leaf = path.back();
+  auto stored = std::find(leaf->points.begin(), leaf->points.end(), from);
+
+  // Compared in the area type rather than by growing the box, which would
+  // overflow integral coordinates near the limits of T
+  using Wide = typename AreaOf<T>::type;
+  auto within = [slack = static_cast<Wide>(tolerance)](T low, T value,
+                                                       T high) {
+    return static_cast<Wide>(low) - static_cast<Wide>(value) <= slack &&
+           static_cast<Wide>(value) - static_cast<Wide>(high) <= slack;
+  };
+  const MBB<T> &box = leaf->boundingBox;
+  if (leaf == root ||
+      (within(box.lowerLeft.getX().getValue(), to.getX().getValue(),
+              box.upperRight.getX().getValue()) &&
+       within(box.lowerLeft.getY().getValue(), to.getY().getValue(),
+              box.upperRight.getY().getValue()))) {
+    *stored = to;
+    refreshPath(path, path.size() - 1);
+    return true;
+  }
+
+  // Climb to the lowest ancestor already covering `to` and descend from
+  // there, so only that subtree is searched
+  size_t top = path.size() - 2;
+  while (top > 0 && !path[top]->boundingBox.contains(to)) {
+    --top;
+  }
+  std::vector<RNode<T> *> target(
+      path.begin(), path.begin() + static_cast<std::ptrdiff_t>(top) + 1);
+  while (!target.back()->isLeaf) {
+    RNode<T> *node = target.back();
+    target.push_back(node->exclusiveChild(node->chooseSubtree(to)));
+  }
+  RNode<T> *destination = target.back();
+  if (destination == leaf) {
+    *stored = to;
+    refreshPath(path, path.size() - 1);
+    return true;
+  }
+  if (destination->points.size() >= params.maxChildren ||
+      leaf->points.size() <= params.minChildren) {
+    remove(from);
+    insert(to);
+    return true;
+  }
+
+  leaf->points.erase(stored);
+  destination->points.push_back(to);
+  // Both branches below `top` first, then the shared part above it
+  for (size_t i = path.size(); i-- > top + 1;) {
+    path[i]->updateBoundingBox(params);
+  }
+  refreshPath(target, target.size() - 1);
+  return true;
+}
+
+template <Coordinate T>
+void RTree<T>::collectPoints(RNode<T> *node,
+                             std::vector<Point<T>> &out) const {
+  SmallStack<RNode<T> *> pending;
+  pending.push(node);
+  while (!pending.empty()) {
+    RNode<T> *current = pending.pop();
+    if (current->isLeaf) {
+      out.insert(out.end(), current->points.begin(), current->points.end());
+      continue;
+    }
+    for (auto *child : current->children) {
+      pending.push(child);
+    }
+  }
+}
+
+template <Coordinate T>
 auto RTree<T>::query(const QueryBox<T> &q) -> std::vector<Point<T>> {
   return root->query(q);
 }
 
-template <std::floating_point T> void RTree<T>::print() const {
+template <Coordinate T>
+auto RTree<T>::operator=(RTree &&other) noexcept -> RTree & {
+  if (this != &other) {
+    if (root != nullptr) {
+      RNode<T>::release(root);
+    }
+    root = other.root;
+    params = other.params;
+    monoid = std::move(other.monoid);
+    other.root = nullptr;
+  }
+  return *this;
+}
+
+template <Coordinate T> auto RTree<T>::clone() const -> RTree {
+  return RTree(RNode<T>::cloneTree(root), params, monoid);
+}
+
+template <Coordinate T> auto RTree<T>::share() const -> RTree {
+  root->refs.fetch_add(1);
+  return RTree(root, params, monoid);
+}
+
+template <Coordinate T> auto RTree<T>::freeze() const -> FrozenRTree<T> {
+  return FrozenRTree<T>(*this);
+}
+
+template <Coordinate T>
+auto RTree<T>::bulkLoad(std::vector<Point<T>> points, uint _minChildren,
+                        uint _maxChildren) -> RTree {
+  RTree tree(_minChildren, _maxChildren);
+  if (points.empty()) {
+    return tree;
+  }
+
+  auto pointCenter = [](const Point<T> &point) {
+    return std::pair{point.getX().getValue(), point.getY().getValue()};
+  };
+  std::vector<RNode<T> *> level;
+  size_t first = 0;
+  for (size_t size :
+       sortTileRecursive(points, tree.params.maxChildren, pointCenter)) {
+    auto *leaf = new RNode<T>(true);
+    leaf->points.assign(
+        points.begin() + static_cast<std::ptrdiff_t>(first),
+        points.begin() + static_cast<std::ptrdiff_t>(first + size));
+    leaf->updateBoundingBox(tree.params);
+    level.push_back(leaf);
+    first += size;
+  }
+
+  // Widened before adding, so integral centers cannot overflow
+  auto nodeCenter = [](const RNode<T> *node) {
+    const MBB<T> &box = node->boundingBox;
+    return std::pair{
+        static_cast<double>(box.lowerLeft.getX().getValue()) +
+            static_cast<double>(box.upperRight.getX().getValue()),
+        static_cast<double>(box.lowerLeft.getY().getValue()) +
+            static_cast<double>(box.upperRight.getY().getValue())};
+  };
+  while (level.size() > 1) {
+    std::vector<RNode<T> *> parents;
+    first = 0;
+    for (size_t size :
+         sortTileRecursive(level, tree.params.maxChildren, nodeCenter)) {
+      auto *node = new RNode<T>(false);
+      for (size_t i = first; i < first + size; ++i) {
+        node->children.push_back(level[i]);
+        level[i]->parent = node;
+      }
+      node->updateBoundingBox(tree.params);
+      parents.push_back(node);
+      first += size;
+    }
+    level = std::move(parents);
+  }
+
+  RNode<T>::release(tree.root);
+  tree.root = level.front();
+  return tree;
+}
+
+template <Coordinate T>
+auto RTree<T>::knn(const Point<T> &point, size_t k) const
+    -> std::vector<Point<T>> {
+  return root->knn(point, k);
+}
+
+template <Coordinate T>
+auto RTree<T>::count(const QueryBox<T> &q) const -> size_t {
+  return root->count(q);
+}
+
+template <Coordinate T>
+auto RTree<T>::aggregate(const QueryBox<T> &q) const -> Safe<T> {
+  if (!monoid) {
+    throw std::runtime_error("RTree was built without an aggregate monoid");
+  }
+  return root->aggregate(q, *monoid);
+}
+
+template <Coordinate T> void RTree<T>::print() const {
   root->print(0);
 }
 
 template class RTree<float>;
+template class RTree<double>;
+template class RTree<int32_t>;
+template class RTree<int64_t>;
@@ -0,0 +1,285 @@
+#include "ShardedRTree.h"
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+
+namespace {
+// Value at quantile i / parts of sorted `values`
+template <Coordinate T>
+auto cutsOf(const std::vector<T> &values, size_t parts) -> std::vector<T> {
+  std::vector<T> cuts;
+  for (size_t i = 1; i < parts; ++i) {
+    cuts.push_back(values.empty() ? T{} : values[i * values.size() / parts]);
+  }
+  return cuts;
+}
+
+template <Coordinate T>
+auto uniformCuts(T low, T high, size_t parts) -> std::vector<T> {
+  std::vector<T> cuts;
+  for (size_t i = 1; i < parts; ++i) {
+    double at = static_cast<double>(low) +
+                (static_cast<double>(high) - static_cast<double>(low)) *
+                    static_cast<double>(i) / static_cast<double>(parts);
+    cuts.push_back(static_cast<T>(at));
+  }
+  return cuts;
+}
+
+// Index of the range a value falls into; cut values go to the upper range
+template <Coordinate T>
+auto rangeOf(const std::vector<T> &cuts, T value) -> size_t {
+  return static_cast<size_t>(std::upper_bound(cuts.begin(), cuts.end(), value) -
+                             cuts.begin());
+}
+} // namespace
+
+template <Coordinate T>
+auto SpatialPartition<T>::grid(const MBB<T> &domain, size_t columns,
+                               size_t rows) -> SpatialPartition {
+  if (columns == 0 || rows == 0) {
+    throw std::runtime_error("A partition needs at least one region");
+  }
+  SpatialPartition partition;
+  partition.xCuts = uniformCuts(domain.lowerLeft.getX().getValue(),
+                                domain.upperRight.getX().getValue(), columns);
+  partition.yCuts.assign(columns,
+                         uniformCuts(domain.lowerLeft.getY().getValue(),
+                                     domain.upperRight.getY().getValue(),
+                                     rows));
+  return partition;
+}
+
+template <Coordinate T>
+auto SpatialPartition<T>::quantiles(std::vector<Point<T>> sample,
+                                    size_t shards) -> SpatialPartition {
+  if (sample.empty() || shards == 0) {
+    throw std::runtime_error("A partition needs a sample and a region");
+  }
+  // As square as possible while columns * rows == shards
+  auto columns = static_cast<size_t>(std::sqrt(static_cast<double>(shards)));
+  while (shards % columns != 0) {
+    --columns;
+  }
+  size_t rows = shards / columns;
+
+  std::vector<T> xs;
+  for (const auto &point : sample) {
+    xs.push_back(point.getX().getValue());
+  }
+  std::sort(xs.begin(), xs.end());
+  SpatialPartition partition;
+  partition.xCuts = cutsOf(xs, columns);
+
+  std::vector<std::vector<T>> ys(columns);
+  for (const auto &point : sample) {
+    ys[rangeOf(partition.xCuts, point.getX().getValue())].push_back(
+        point.getY().getValue());
+  }
+  for (auto &column : ys) {
+    std::sort(column.begin(), column.end());
+    partition.yCuts.push_back(cutsOf(column, rows));
+  }
+  return partition;
+}
+
+template <Coordinate T> auto SpatialPartition<T>::size() const -> size_t {
+  return yCuts.size() * (yCuts.front().size() + 1);
+}
+
+template <Coordinate T>
+auto SpatialPartition<T>::shardOf(const Point<T> &point) const -> size_t {
+  size_t column = rangeOf(xCuts, point.getX().getValue());
+  size_t row = rangeOf(yCuts[column], point.getY().getValue());
+  return column * (yCuts[column].size() + 1) + row;
+}
+
+template <Coordinate T>
+auto SpatialPartition<T>::region(size_t shard) const -> MBB<T> {
+  constexpr T lowest = std::numeric_limits<T>::lowest();
+  constexpr T highest = std::numeric_limits<T>::max();
+  size_t rows = yCuts.front().size() + 1;
+  size_t column = shard / rows;
+  size_t row = shard % rows;
+  const std::vector<T> &columnCuts = yCuts[column];
+  return MBB<T>(
+      Point<T>(column == 0 ? lowest : xCuts[column - 1],
+               row == 0 ? lowest : columnCuts[row - 1]),
+      Point<T>(column == xCuts.size() ? highest : xCuts[column],
+               row == columnCuts.size() ? highest : columnCuts[row]));
+}
+
+template <Coordinate T>
+ShardedRTree<T>::ShardedRTree(SpatialPartition<T> _partition,
+                              ShardedOptions _options)
+    : partition(std::move(_partition)), options(_options) {
+  for (size_t i = 0; i < partition.size(); ++i) {
+    shards.push_back(std::make_unique<Shard>(
+        options.minChildren, options.maxChildren, partition.region(i)));
+  }
+  for (auto &shard : shards) {
+    shard->writer = std::thread(writerLoop, std::ref(*shard));
+  }
+}
+
+template <Coordinate T> ShardedRTree<T>::~ShardedRTree() {
+  // Writers drain their queues before they exit
+  for (auto &shard : shards) {
+    std::unique_lock lock(shard->queueMutex);
+    shard->stopping = true;
+    shard->queueChanged.notify_all();
+  }
+  for (auto &shard : shards) {
+    shard->writer.join();
+  }
+}
+
+template <Coordinate T>
+void ShardedRTree<T>::enqueue(bool insert, const Point<T> &point) {
+  Shard &shard = *shards[partition.shardOf(point)];
+  std::unique_lock lock(shard.queueMutex);
+  shard.queueChanged.wait(lock, [&] {
+    return shard.queue.size() < options.queueCapacity;
+  });
+  shard.queue.push_back({insert, point});
+  // The writer only sleeps on an empty queue
+  if (shard.queue.size() == 1) {
+    shard.queueChanged.notify_all();
+  }
+}
+
+template <Coordinate T> void ShardedRTree<T>::writerLoop(Shard &shard) {
+  std::vector<Operation> batch;
+  std::unique_lock queueLock(shard.queueMutex);
+  while (true) {
+    shard.queueChanged.wait(queueLock, [&] {
+      return shard.stopping || !shard.queue.empty();
+    });
+    if (shard.queue.empty()) {
+      return;
+    }
+
+    // Take the whole queue and apply it under a single tree lock
+    batch.swap(shard.queue);
+    shard.applying = true;
+    queueLock.unlock();
+    shard.queueChanged.notify_all();
+    {
+      std::unique_lock treeLock(shard.treeMutex);
+      for (const auto &operation : batch) {
+        if (operation.insert) {
+          shard.tree.insert(operation.point);
+        } else {
+          shard.tree.remove(operation.point);
+        }
+      }
+    }
+    batch.clear();
+
+    queueLock.lock();
+    shard.applying = false;
+    shard.queueChanged.notify_all();
+  }
+}
+
+template <Coordinate T> void ShardedRTree<T>::flush() {
+  for (auto &shard : shards) {
+    std::unique_lock lock(shard->queueMutex);
+    shard->queueChanged.wait(lock, [&] {
+      return shard->queue.empty() && !shard->applying;
+    });
+  }
+}
+
+template <Coordinate T>
+auto ShardedRTree<T>::search(const Point<T> &point) const -> bool {
+  Shard &shard = *shards[partition.shardOf(point)];
+  std::shared_lock lock(shard.treeMutex);
+  return shard.tree.search(point);
+}
+
+template <Coordinate T>
+auto ShardedRTree<T>::query(const QueryBox<T> &q) const
+    -> std::vector<Point<T>> {
+  std::vector<Point<T>> result;
+  for (const auto &shard : shards) {
+    if (!q.intersects(shard->region)) {
+      continue;
+    }
+    std::shared_lock lock(shard->treeMutex);
+    std::vector<Point<T>> found = shard->tree.query(q);
+    result.insert(result.end(), found.begin(), found.end());
+  }
+  return result;
+}
+
+template <Coordinate T>
+auto ShardedRTree<T>::count(const QueryBox<T> &q) const -> size_t {
+  size_t result = 0;
+  for (const auto &shard : shards) {
+    if (q.intersects(shard->region)) {
+      std::shared_lock lock(shard->treeMutex);
+      result += shard->tree.count(q);
+    }
+  }
+  return result;
+}
+
+template <Coordinate T>
+auto ShardedRTree<T>::knn(const Point<T> &point, size_t k) const
+    -> std::vector<Point<T>> {
+  if (k == 0) {
+    return {};
+  }
+  // Shards are visited nearest region first; once k points are closer than
+  // the next region, no further shard can contribute
+  std::vector<std::pair<double, const Shard *>> order;
+  for (const auto &shard : shards) {
+    order.emplace_back(shard->region.distanceSquared(point), shard.get());
+  }
+  std::sort(order.begin(), order.end(),
+            [](const auto &a, const auto &b) { return a.first < b.first; });
+
+  auto distance = [&point](const Point<T> &candidate) {
+    return MBB<T>(candidate, candidate).distanceSquared(point);
+  };
+  auto nearer = [&](const Point<T> &a, const Point<T> &b) {
+    return distance(a) < distance(b);
+  };
+  std::vector<Point<T>> result;
+  for (const auto &[regionDistance, shard] : order) {
+    if (result.size() >= k && distance(result[k - 1]) <= regionDistance) {
+      break;
+    }
+    std::vector<Point<T>> found;
+    {
+      std::shared_lock lock(shard->treeMutex);
+      found = shard->tree.knn(point, k);
+    }
+    std::vector<Point<T>> merged;
+    std::merge(result.begin(), result.end(), found.begin(), found.end(),
+               std::back_inserter(merged), nearer);
+    merged.resize(std::min(merged.size(), k));
+    result = std::move(merged);
+  }
+  return result;
+}
+
+template <Coordinate T> auto ShardedRTree<T>::size() const -> size_t {
+  size_t result = 0;
+  for (const auto &shard : shards) {
+    std::shared_lock lock(shard->treeMutex);
+    result += shard->tree.size();
+  }
+  return result;
+}
+
+template struct SpatialPartition<float>;
+template struct SpatialPartition<double>;
+template struct SpatialPartition<int32_t>;
+template struct SpatialPartition<int64_t>;
+template class ShardedRTree<float>;
+template class ShardedRTree<double>;
+template class ShardedRTree<int32_t>;
+template class ShardedRTree<int64_t>;
@@ -1,9 +1,30 @@
+#include "CachedRTree.h"
+#include "CompactRTree.h"
+#include "ConcurrentRTree.h"
+#include "HilbertRTree.h"
+#include "LsmRTree.h"
+#include "PersistentRTree.h"
+#include "ShardedRTree.h"
 #include "Rtree.h"
+#include "Traversal.h"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <csignal>
 #include <cstdlib>
 #include <ctime>
+#include <filesystem>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <optional>
 #include <random>
+#include <set>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
 
 constexpr size_t POINTS = 100;
 constexpr auto RANGE = 10;
@@ -155,6 +176,1504 @@ auto testChildrenInParentMBB(RTree<float> &tree) -> bool {
   }
   return checkChildrenInParentMBB(root);
 }
+
+auto testCountMatchesQuery(RTree<float> &tree) -> bool {
+  const auto half = static_cast<float>(RANGE) / 2;
+  std::vector<QueryBox<float>> boxes = {
+      QueryBox<float>(Point<float>(0, 0), Point<float>(RANGE, RANGE)),
+      QueryBox<float>(Point<float>(0, 0), Point<float>(half, half)),
+      QueryBox<float>(Point<float>(half / 2, 0), Point<float>(RANGE, half))};
+  for (const auto &box : boxes) {
+    if (tree.count(box) != tree.query(box).size()) {
+      std::cout << "Count does not match query size: " << tree.count(box)
+                << " vs " << tree.query(box).size() << '\n';
+      return false;
+    }
+  }
+  return true;
+}
+
+auto testAggregateMatchesQuery() -> bool {
+  // Folds each monoid over query() and compares it with aggregate(), while
+  // inserts split nodes, removes condense them and updates move points.
+  // Clones and shared snapshots must keep the aggregates they were taken
+  // with.
+  using P = Point<int32_t>;
+  constexpr int32_t range = 1000;
+  std::vector<Monoid<int32_t>> monoids = {
+      {[](const P &point) { return point.getX(); },
+       [](const Safe<int32_t> &a, const Safe<int32_t> &b) { return a + b; },
+       Safe<int32_t>(0)},
+      {[](const P &point) { return point.getY(); },
+       [](const Safe<int32_t> &a, const Safe<int32_t> &b) {
+         return std::max(a, b);
+       },
+       Safe<int32_t>(-1)}};
+  std::mt19937 rng(26);
+  std::uniform_int_distribution<int32_t> coordinate(0, range);
+  auto randomPoint = [&]() { return P(coordinate(rng), coordinate(rng)); };
+  auto matches = [&](RTree<int32_t> &tree, const Monoid<int32_t> &monoid) {
+    for (int i = 0; i < 50; ++i) {
+      int32_t x1 = coordinate(rng);
+      int32_t x2 = coordinate(rng);
+      int32_t y1 = coordinate(rng);
+      int32_t y2 = coordinate(rng);
+      QueryBox<int32_t> q(P(std::min(x1, x2), std::min(y1, y2)),
+                          P(std::max(x1, x2), std::max(y1, y2)));
+      Safe<int32_t> folded = monoid.identity;
+      for (const auto &point : tree.query(q)) {
+        folded = monoid.combine(folded, monoid.lift(point));
+      }
+      if (tree.aggregate(q) != folded) {
+        std::cout << "Aggregate " << tree.aggregate(q).getValue()
+                  << " differs from the folded query " << folded.getValue()
+                  << '\n';
+        return false;
+      }
+    }
+    return true;
+  };
+
+  for (const auto &monoid : monoids) {
+    RTree<int32_t> tree(2, 4, monoid);
+    std::vector<P> points;
+    for (int i = 0; i < 1000; ++i) {
+      points.push_back(randomPoint());
+      tree.insert(points.back());
+    }
+    RTree<int32_t> cloned = tree.clone();
+    RTree<int32_t> shared = tree.share();
+    if (!matches(tree, monoid)) {
+      return false;
+    }
+
+    for (int i = 0; i < 400; ++i) {
+      size_t victim = rng() % points.size();
+      tree.remove(points[victim]);
+      points[victim] = points.back();
+      points.pop_back();
+    }
+    for (int i = 0; i < 400; ++i) {
+      size_t moving = rng() % points.size();
+      P to = randomPoint();
+      tree.update(points[moving], to, static_cast<int32_t>(i % 3 * 8));
+      points[moving] = to;
+    }
+    if (tree.size() != points.size() || !matches(tree, monoid) ||
+        !matches(cloned, monoid) || !matches(shared, monoid)) {
+      return false;
+    }
+    QueryBox<int32_t> everything(P(0, 0), P(range, range));
+    if (cloned.aggregate(everything) != shared.aggregate(everything)) {
+      std::cout << "Clone and snapshot aggregates differ\n";
+      return false;
+    }
+  }
+
+  RTree<int32_t> plain(2, 4);
+  try {
+    (void)plain.aggregate(QueryBox<int32_t>(P(0, 0), P(range, range)));
+  } catch (const std::runtime_error &) {
+    return true;
+  }
+  std::cout << "aggregate() on a tree without a monoid did not throw\n";
+  return false;
+}
+
+auto testSmallStackSpill() -> bool {
+  // Four inline entries, so most of these spill to the heap
+  SmallStack<int, 4> stack;
+  for (int round = 0; round < 2; ++round) {
+    for (int i = 0; i < 200; ++i) {
+      stack.push(i);
+    }
+    for (int i = 200; i-- > 0;) {
+      if (stack.empty() || stack.pop() != i) {
+        std::cout << "SmallStack lost LIFO order at " << i << '\n';
+        return false;
+      }
+    }
+    if (!stack.empty()) {
+      std::cout << "SmallStack not empty after popping everything\n";
+      return false;
+    }
+    stack.push(-1);
+    stack.clear();
+  }
+  return stack.empty();
+}
+
+auto testWideTreeWalk() -> bool {
+  // With 100 children per node a walk keeps well over 64 nodes pending,
+  // so every traversal spills its SmallStack
+  std::vector<Point<float>> points;
+  std::mt19937 rng(27);
+  std::uniform_real_distribution<float> dist(0.0F, static_cast<float>(RANGE));
+  for (size_t i = 0; i < 20000; ++i) {
+    points.emplace_back(dist(rng), dist(rng));
+  }
+  RTree<float> wide = RTree<float>::bulkLoad(points, 2, 100);
+  // A few inserts so split nodes are walked as well
+  for (size_t i = 0; i < 500; ++i) {
+    points.emplace_back(dist(rng), dist(rng));
+    wide.insert(points.back());
+  }
+  QueryBox<float> all(Point<float>(0, 0), Point<float>(RANGE, RANGE));
+  QueryBox<float> half(Point<float>(0, 0), Point<float>(RANGE, RANGE / 2.0F));
+  size_t inHalf = static_cast<size_t>(std::count_if(
+      points.begin(), points.end(),
+      [&half](const auto &point) { return half.contains(point); }));
+  if (wide.query(all).size() != points.size() ||
+      wide.query(half).size() != inHalf || wide.count(half) != inHalf) {
+    std::cout << "Wide tree walk missed points\n";
+    return false;
+  }
+  for (size_t i = 0; i < points.size(); i += 7) {
+    if (!wide.search(points[i])) {
+      std::cout << "Point not found in wide tree: " << points[i] << '\n';
+      return false;
+    }
+  }
+  return true;
+}
+
+auto testDegenerateTree() -> bool {
+  // Identical points give every node the same empty box, so a lookup has to
+  // try every child
+  RTree<float> same(2, 100);
+  Point<float> point(1, 1);
+  for (size_t i = 0; i < 2000; ++i) {
+    same.insert(point);
+  }
+  QueryBox<float> box(point, point);
+  if (same.count(box) != 2000 || same.query(box).size() != 2000) {
+    std::cout << "Degenerate tree lost duplicates\n";
+    return false;
+  }
+  for (size_t i = 0; i < 2000; ++i) {
+    if (!same.search(point)) {
+      std::cout << "Duplicate " << i << " not found\n";
+      return false;
+    }
+    same.remove(point);
+  }
+  return same.size() == 0 && !same.search(point);
+}
+
+// Every stored point as sorted coordinates, for comparing trees
+template <Coordinate T>
+auto contents(const std::vector<Point<T>> &points)
+    -> std::vector<std::pair<T, T>> {
+  std::vector<std::pair<T, T>> result;
+  result.reserve(points.size());
+  for (const auto &point : points) {
+    result.emplace_back(point.getX().getValue(), point.getY().getValue());
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+auto contents(RTree<float> &tree) -> std::vector<std::pair<float, float>> {
+  return contents(
+      tree.query(QueryBox<float>(Point<float>(-RANGE, -RANGE),
+                                 Point<float>(2 * RANGE, 2 * RANGE))));
+}
+
+auto contents(RTree<int32_t> &tree)
+    -> std::vector<std::pair<int32_t, int32_t>> {
+  constexpr int32_t lowest = std::numeric_limits<int32_t>::min();
+  constexpr int32_t highest = std::numeric_limits<int32_t>::max();
+  return contents(tree.query(QueryBox<int32_t>(
+      Point<int32_t>(lowest, lowest), Point<int32_t>(highest, highest))));
+}
+
+auto testCopyOnWrite() -> bool {
+  std::mt19937 rng(28);
+  std::uniform_real_distribution<float> dist(0.0F, static_cast<float>(RANGE));
+  std::vector<Point<float>> points;
+  RTree<float> original;
+  for (size_t i = 0; i < 500; ++i) {
+    points.emplace_back(dist(rng), dist(rng));
+    original.insert(points.back());
+  }
+  auto before = contents(original);
+
+  // Writes to the snapshot must copy shared nodes, not change them
+  RTree<float> snapshot = original.share();
+  for (size_t i = 0; i < 200; ++i) {
+    snapshot.remove(points[i]);
+    snapshot.insert(Point<float>(dist(rng), dist(rng)));
+  }
+  snapshot.update(points[300], Point<float>(RANGE + 1, RANGE + 1));
+  auto changed = contents(snapshot);
+  if (contents(original) != before || original.size() != points.size()) {
+    std::cout << "Writing to a snapshot changed the original\n";
+    return false;
+  }
+
+  // And the other way around
+  for (size_t i = 200; i < 300; ++i) {
+    original.remove(points[i]);
+  }
+  if (contents(snapshot) != changed || original.size() != 400) {
+    std::cout << "Writing to the original changed the snapshot\n";
+    return false;
+  }
+  return testTreeBalance(snapshot) && testChildrenInParentMBB(snapshot) &&
+         testPointsInBoundingBox(original);
+}
+
+auto testCloneMoved() -> bool {
+  std::mt19937 rng(280);
+  std::uniform_real_distribution<float> dist(0.0F, static_cast<float>(RANGE));
+  RTree<float> source;
+  for (size_t i = 0; i < 300; ++i) {
+    source.insert(Point<float>(dist(rng), dist(rng)));
+  }
+  auto expected = contents(source);
+
+  RTree<float> moved(std::move(source));
+  RTree<float> assigned;
+  assigned.insert(Point<float>(1, 1));
+  assigned = std::move(moved);
+  RTree<float> copy = assigned.clone();
+  if (contents(copy) != expected || contents(assigned) != expected) {
+    std::cout << "clone() of a moved tree differs from the source\n";
+    return false;
+  }
+  copy.insert(Point<float>(RANGE + 1, 0));
+  assigned.remove(Point<float>(expected[0].first, expected[0].second));
+  if (copy.size() != expected.size() + 1 ||
+      assigned.size() != expected.size() - 1) {
+    std::cout << "clone() shares nodes with its source\n";
+    return false;
+  }
+  return testTreeBalance(copy);
+}
+
+auto testSharedRelease() -> bool {
+  // ASan reports any node freed twice or used after its last owner is gone.
+  // Every pair is destroyed in both orders, including clone() blocks that
+  // are partly shared.
+  std::mt19937 rng(2800);
+  std::uniform_real_distribution<float> dist(0.0F, static_cast<float>(RANGE));
+  RTree<float> base;
+  for (size_t i = 0; i < 300; ++i) {
+    base.insert(Point<float>(dist(rng), dist(rng)));
+  }
+  auto expected = contents(base);
+
+  for (int order = 0; order < 2; ++order) {
+    auto first = std::make_unique<RTree<float>>(base.clone());
+    auto second = std::make_unique<RTree<float>>(first->share());
+    second->insert(Point<float>(RANGE + 1, 0));
+    first->remove(Point<float>(expected[0].first, expected[0].second));
+    if (order == 0) {
+      first.reset();
+      if (second->size() != expected.size() + 1) {
+        std::cout << "Snapshot broken after its source was destroyed\n";
+        return false;
+      }
+    } else {
+      second.reset();
+      if (first->size() != expected.size() - 1) {
+        std::cout << "Clone broken after its snapshot was destroyed\n";
+        return false;
+      }
+    }
+  }
+
+  {
+    RTree<float> snapshot = base.share();
+    RTree<float> nested = snapshot.share();
+    nested.insert(Point<float>(0, RANGE + 1));
+  }
+  return contents(base) == expected;
+}
+
+template <Coordinate T>
+auto randomCoordinate(std::mt19937 &rng, T low, T high) -> T {
+  if constexpr (std::integral<T>) {
+    return std::uniform_int_distribution<T>(low, high)(rng);
+  } else {
+    return std::uniform_real_distribution<T>(low, high)(rng);
+  }
+}
+
+template <Coordinate T>
+auto randomBox(std::mt19937 &rng, T low, T high) -> QueryBox<T> {
+  T x1 = randomCoordinate(rng, low, high);
+  T x2 = randomCoordinate(rng, low, high);
+  T y1 = randomCoordinate(rng, low, high);
+  T y2 = randomCoordinate(rng, low, high);
+  return QueryBox<T>(Point<T>(std::min(x1, x2), std::min(y1, y2)),
+                     Point<T>(std::max(x1, x2), std::max(y1, y2)));
+}
+
+// Upper end of a cluster in the lowest thousandth of [low, high]
+template <Coordinate T> auto clusterTop(T low, T high) -> T {
+  return static_cast<T>(low + (high / 1000 - low / 1000));
+}
+
+// Uniform points plus a dense cluster and duplicates, so some boxes are far
+// smaller than one quantization cell of their parent
+template <Coordinate T>
+auto randomPoints(std::mt19937 &rng, size_t n, T low, T high)
+    -> std::vector<Point<T>> {
+  std::vector<Point<T>> points;
+  for (size_t i = 0; i < n; ++i) {
+    T top = i % 4 == 0 ? clusterTop(low, high) : high;
+    points.emplace_back(randomCoordinate(rng, low, top),
+                        randomCoordinate(rng, low, top));
+    if (i % 50 == 0) {
+      points.push_back(points.back());
+    }
+  }
+  return points;
+}
+
+template <Coordinate T>
+auto bruteQuery(const std::vector<Point<T>> &points, const QueryBox<T> &q)
+    -> std::vector<Point<T>> {
+  std::vector<Point<T>> result;
+  std::copy_if(points.begin(), points.end(), std::back_inserter(result),
+               [&q](const auto &point) { return q.contains(point); });
+  return result;
+}
+
+template <Coordinate T, std::unsigned_integral Q>
+auto testCompactMatches(T low, T high) -> bool {
+  std::mt19937 rng(29);
+  std::vector<Point<T>> points = randomPoints(rng, 3000, low, high);
+  RTree<T> tree(2, 8);
+  for (const auto &point : points) {
+    tree.insert(point);
+  }
+  CompactRTree<T, Q> compact(tree);
+  if (compact.size() != points.size()) {
+    std::cout << "CompactRTree holds " << compact.size() << " of "
+              << points.size() << " points\n";
+    return false;
+  }
+  for (size_t i = 0; i < points.size(); i += 3) {
+    if (!compact.search(points[i])) {
+      std::cout << "Point not found in CompactRTree: " << points[i] << '\n';
+      return false;
+    }
+  }
+  for (size_t i = 0; i < 300; ++i) {
+    Point<T> point(randomCoordinate(rng, low, high),
+                   randomCoordinate(rng, low, high));
+    bool stored =
+        std::find(points.begin(), points.end(), point) != points.end();
+    if (compact.search(point) != stored) {
+      std::cout << "CompactRTree search wrong for " << point << '\n';
+      return false;
+    }
+  }
+  for (size_t i = 0; i < 300; ++i) {
+    // Every other box inside the cluster
+    T top = i % 2 == 0 ? high : clusterTop(low, high);
+    QueryBox<T> q = randomBox(rng, low, top);
+    auto expected = contents(bruteQuery(points, q));
+    if (contents(compact.query(q)) != expected ||
+        compact.count(q) != expected.size()) {
+      std::cout << "CompactRTree query or count wrong: " << expected.size()
+                << " expected, " << compact.query(q).size() << " queried, "
+                << compact.count(q) << " counted\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+template <Coordinate T> auto testCoordinateType(T low, T high) -> bool {
+  std::mt19937 rng(30);
+  std::vector<Point<T>> points = randomPoints(rng, 2000, low, high);
+  RTree<T> tree(2, 8);
+  for (const auto &point : points) {
+    tree.insert(point);
+  }
+  for (const auto &point : points) {
+    if (!tree.search(point)) {
+      std::cout << "Point not found in RTree: " << point << '\n';
+      return false;
+    }
+  }
+  auto check = [&]() {
+    for (size_t i = 0; i < 100; ++i) {
+      T top = i % 2 == 0 ? high : clusterTop(low, high);
+      QueryBox<T> q = randomBox(rng, low, top);
+      auto expected = contents(bruteQuery(points, q));
+      if (contents(tree.query(q)) != expected ||
+          tree.count(q) != expected.size()) {
+        std::cout << "Query or count wrong: " << expected.size()
+                  << " expected, " << tree.count(q) << " counted\n";
+        return false;
+      }
+    }
+    Point<T> center(randomCoordinate(rng, low, high),
+                    randomCoordinate(rng, low, high));
+    auto nearest = tree.knn(center, 5);
+    std::vector<double> distances;
+    for (const auto &point : points) {
+      distances.push_back(MBB<T>(point, point).distanceSquared(center));
+    }
+    std::sort(distances.begin(), distances.end());
+    for (size_t i = 0; i < nearest.size(); ++i) {
+      if (MBB<T>(nearest[i], nearest[i]).distanceSquared(center) !=
+          distances[i]) {
+        std::cout << "knn result " << i << " is not the nearest\n";
+        return false;
+      }
+    }
+    return tree.size() == points.size() && nearest.size() == 5;
+  };
+  if (!check()) {
+    return false;
+  }
+  // Removing one copy of a duplicate must keep the other
+  for (size_t i = 0; i < points.size() / 2; ++i) {
+    tree.remove(points.back());
+    points.pop_back();
+  }
+  return check();
+}
+
+auto testIntegralArea() -> bool {
+  // Both extents of the full int32 range: the exact area does not fit an
+  // int64, so it has to saturate rather than wrap around
+  constexpr int32_t lowest = std::numeric_limits<int32_t>::min();
+  constexpr int32_t highest = std::numeric_limits<int32_t>::max();
+  MBB<int32_t> full(Point<int32_t>(lowest, lowest),
+                    Point<int32_t>(highest, highest));
+  MBB<int32_t> strip(Point<int32_t>(lowest, 0), Point<int32_t>(highest, 2));
+  constexpr int64_t extent = int64_t{highest} - int64_t{lowest};
+  if (full.area() != std::numeric_limits<int64_t>::max() ||
+      strip.area() != 2 * extent || full.perimeter() != 4 * extent ||
+      full.intersectionArea(strip) != 2 * extent) {
+    std::cout << "Integral areas wrong: " << full.area() << ", "
+              << strip.area() << ", " << full.perimeter() << '\n';
+    return false;
+  }
+
+  // The corners of the range are stored and found like any other point
+  RTree<int32_t> tree(2, 4);
+  std::vector<Point<int32_t>> corners = {
+      Point<int32_t>(lowest, lowest), Point<int32_t>(lowest, highest),
+      Point<int32_t>(highest, lowest), Point<int32_t>(highest, highest),
+      Point<int32_t>(0, 0)};
+  for (int round = 0; round < 10; ++round) {
+    for (const auto &corner : corners) {
+      tree.insert(corner);
+    }
+  }
+  QueryBox<int32_t> everything(corners[0], corners[3]);
+  if (tree.count(everything) != 50 || tree.query(everything).size() != 50 ||
+      !tree.search(corners[1])) {
+    return false;
+  }
+
+  // Inserting below an internal node whose children all saturate the
+  // expansion cost must still pick one of them
+  const std::vector<int32_t> extremes = {lowest, -2000000000, 0, 2000000000,
+                                         highest};
+  std::mt19937 rng(30);
+  std::uniform_int_distribution<size_t> pick(0, extremes.size() - 1);
+  for (int round = 0; round < 2000; ++round) {
+    RTree<int32_t> extreme(2, 4);
+    for (int i = 0; i < 12; ++i) {
+      extreme.insert(Point<int32_t>(extremes[pick(rng)], extremes[pick(rng)]));
+    }
+    if (extreme.count(everything) != 12) {
+      std::cout << "Full-range int32 tree lost points\n";
+      return false;
+    }
+  }
+  return testCoordinateType<int32_t>(lowest, highest);
+}
+
+auto testExactIntegers() -> bool {
+  // Neighbouring int64 values above 2^53 collapse to the same double, and a
+  // float epsilon would merge them as well
+  constexpr int64_t big = (int64_t{1} << 60) + 1;
+  if (Safe<int64_t>(big) == Safe<int64_t>(big + 1) ||
+      !(Safe<int64_t>(big) < Safe<int64_t>(big + 1)) ||
+      Safe<int32_t>(0) == Safe<int32_t>(1)) {
+    std::cout << "Integral Safe values compare inexactly\n";
+    return false;
+  }
+
+  RTree<int64_t> tree(2, 4);
+  for (int64_t i = 0; i < 100; ++i) {
+    tree.insert(Point<int64_t>(big + i, big - i));
+  }
+  for (int64_t i = 0; i < 100; ++i) {
+    Point<int64_t> point(big + i, big - i);
+    Point<int64_t> neighbour(big + i, big - i + 1);
+    if (!tree.search(point) || tree.search(neighbour) ||
+        tree.count(QueryBox<int64_t>(point, point)) != 1) {
+      std::cout << "int64 point " << point << " not matched exactly\n";
+      return false;
+    }
+  }
+  tree.remove(Point<int64_t>(big + 1, big));
+  return tree.size() == 100 && tree.search(Point<int64_t>(big, big));
+}
+
+// Empty directory for one persistence test
+auto scratchDirectory(const std::string &name) -> std::string {
+  auto path = std::filesystem::temp_directory_path() /
+              ("rtree-" + name + "-" + std::to_string(::getpid()));
+  std::filesystem::remove_all(path);
+  return path.string();
+}
+
+auto stored(PersistentRTree<float> &store)
+    -> std::vector<std::pair<float, float>> {
+  return contents(store.query(QueryBox<float>(
+      Point<float>(-RANGE, -RANGE), Point<float>(2 * RANGE, 2 * RANGE))));
+}
+
+auto testWalReplay() -> bool {
+  std::string directory = scratchDirectory("wal");
+  std::mt19937 rng(31);
+  std::uniform_real_distribution<float> dist(0.0F, static_cast<float>(RANGE));
+  PersistenceOptions options;
+  options.checkpointInterval = 0;
+  std::vector<Point<float>> points;
+
+  // Two sessions without a checkpoint; everything comes back from the log
+  for (int session = 0; session < 2; ++session) {
+    PersistentRTree<float> store(directory, 2, 8, options);
+    for (size_t i = 0; i < 500; ++i) {
+      points.emplace_back(dist(rng), dist(rng));
+      store.insert(points.back());
+    }
+    for (size_t i = 0; i < 100; ++i) {
+      store.remove(points[i]);
+    }
+    points.erase(points.begin(), points.begin() + 100);
+  }
+  PersistentRTree<float> store(directory, 2, 8, options);
+  bool passed = stored(store) == contents(points);
+  if (!passed) {
+    std::cout << "Replayed " << store.size() << " of " << points.size()
+              << " points\n";
+  }
+  std::filesystem::remove_all(directory);
+  return passed;
+}
+
+auto testTornTail() -> bool {
+  std::string directory = scratchDirectory("torn");
+  std::string wal = directory + "/wal.log";
+  PersistenceOptions options;
+  options.checkpointInterval = 0;
+  std::vector<Point<float>> points;
+  {
+    PersistentRTree<float> store(directory, 2, 8, options);
+    for (int i = 0; i < 200; ++i) {
+      points.emplace_back(static_cast<float>(i % 10),
+                          static_cast<float>(i) / 20.0F);
+      store.insert(points.back());
+    }
+  }
+
+  // Cut the last record short, as a crash in the middle of a write would
+  std::filesystem::resize_file(wal, std::filesystem::file_size(wal) - 3);
+  points.pop_back();
+  bool passed = true;
+  {
+    PersistentRTree<float> store(directory, 2, 8, options);
+    passed = stored(store) == contents(points);
+    // New records go where the torn one was, not behind it
+    points.emplace_back(-1.0F, -1.0F);
+    store.insert(points.back());
+  }
+  PersistentRTree<float> store(directory, 2, 8, options);
+  if (!passed || stored(store) != contents(points)) {
+    std::cout << "Torn log tail not discarded: " << store.size() << " of "
+              << points.size() << " points\n";
+    passed = false;
+  }
+  std::filesystem::remove_all(directory);
+  return passed;
+}
+
+auto testCheckpointRecovery() -> bool {
+  std::string directory = scratchDirectory("checkpoint");
+  std::mt19937 rng(310);
+  std::uniform_real_distribution<float> dist(0.0F, static_cast<float>(RANGE));
+  PersistenceOptions options;
+  // Small enough that the run checkpoints and compacts several times, and
+  // leaves operations in the log after the last checkpoint
+  options.checkpointInterval = 700;
+  options.compactionRatio = 2;
+  std::vector<Point<float>> points;
+  size_t smallest = std::numeric_limits<size_t>::max();
+  size_t largest = 0;
+  for (int session = 0; session < 3; ++session) {
+    PersistentRTree<float> store(directory, 2, 8, options);
+    for (size_t i = 0; i < 3000; ++i) {
+      if (i % 3 == 2) {
+        std::uniform_int_distribution<size_t> pick(0, points.size() - 1);
+        size_t victim = pick(rng);
+        store.remove(points[victim]);
+        points.erase(points.begin() + static_cast<std::ptrdiff_t>(victim));
+      } else {
+        points.emplace_back(dist(rng), dist(rng));
+        store.insert(points.back());
+      }
+      if (i % 100 == 0) {
+        size_t size = std::filesystem::file_size(directory + "/checkpoint.dat");
+        smallest = std::min(smallest, size);
+        largest = std::max(largest, size);
+      }
+    }
+  }
+  PersistentRTree<float> store(directory, 2, 8, options);
+  bool passed = stored(store) == contents(points);
+  if (!passed) {
+    std::cout << "Recovered " << store.size() << " of " << points.size()
+              << " points\n";
+  }
+  // Compaction must have shrunk the checkpoint file at least once
+  if (smallest * 2 > largest) {
+    std::cout << "Checkpoint file never compacted\n";
+    passed = false;
+  }
+  std::filesystem::remove_all(directory);
+  return passed;
+}
+
+auto testFailedCheckpoint() -> bool {
+  std::string directory = scratchDirectory("failed");
+  std::mt19937 rng(3100);
+  std::uniform_real_distribution<float> dist(0.0F, static_cast<float>(RANGE));
+  PersistenceOptions options;
+  options.checkpointInterval = 0;
+  std::vector<Point<float>> points;
+  auto insert = [&](PersistentRTree<float> &store, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      points.emplace_back(dist(rng), dist(rng));
+      store.insert(points.back());
+    }
+  };
+
+  bool failed = false;
+  {
+    PersistentRTree<float> store(directory, 2, 8, options);
+    insert(store, 2000);
+    store.checkpoint();
+    insert(store, 20000);
+    store.sync();
+
+    // Let the incremental checkpoint run out of file size halfway through
+    rlimit limit{};
+    ::getrlimit(RLIMIT_FSIZE, &limit);
+    rlimit small = limit;
+    small.rlim_cur = static_cast<rlim_t>(
+        std::filesystem::file_size(directory + "/checkpoint.dat") + 16384);
+    auto previous = std::signal(SIGXFSZ, SIG_IGN);
+    ::setrlimit(RLIMIT_FSIZE, &small);
+    try {
+      store.checkpoint();
+    } catch (const std::runtime_error &) {
+      failed = true;
+    }
+    ::setrlimit(RLIMIT_FSIZE, &limit);
+    std::signal(SIGXFSZ, previous);
+
+    insert(store, 100);
+    store.checkpoint();
+  }
+  PersistentRTree<float> store(directory, 2, 8, options);
+  bool passed = failed && stored(store) == contents(points);
+  if (!passed) {
+    std::cout << "After a failed checkpoint " << store.size() << " of "
+              << points.size() << " points came back\n";
+  }
+  std::filesystem::remove_all(directory);
+  return passed;
+}
+
+using Reference = std::multiset<std::pair<int32_t, int32_t>>;
+
+// Compares an index with a multiset of the points it should hold
+template <typename Index>
+auto matchesReference(Index &index, const Reference &expected,
+                      std::mt19937 &rng, int32_t range) -> bool {
+  auto toPoint = [](const auto &entry) {
+    return Point<int32_t>(entry.first, entry.second);
+  };
+  std::vector<Point<int32_t>> all;
+  std::transform(expected.begin(), expected.end(), std::back_inserter(all),
+                 toPoint);
+  if (index.size() != expected.size()) {
+    std::cout << "Index holds " << index.size() << " of " << expected.size()
+              << " points\n";
+    return false;
+  }
+  for (int i = 0; i < 20; ++i) {
+    QueryBox<int32_t> q = randomBox<int32_t>(rng, 0, range);
+    auto wanted = contents(bruteQuery(all, q));
+    if (contents(index.query(q)) != wanted || index.count(q) != wanted.size()) {
+      std::cout << "Query or count differs from the reference\n";
+      return false;
+    }
+    Point<int32_t> point(randomCoordinate(rng, 0, range),
+                         randomCoordinate(rng, 0, range));
+    bool stored = expected.contains(
+        {point.getX().getValue(), point.getY().getValue()});
+    if (index.search(point) != stored) {
+      std::cout << "Search differs from the reference for " << point << '\n';
+      return false;
+    }
+  }
+
+  Point<int32_t> center(randomCoordinate(rng, 0, range),
+                        randomCoordinate(rng, 0, range));
+  std::vector<double> distances;
+  for (const auto &point : all) {
+    distances.push_back(MBB<int32_t>(point, point).distanceSquared(center));
+  }
+  std::sort(distances.begin(), distances.end());
+  auto nearest = index.knn(center, 7);
+  if (nearest.size() != std::min<size_t>(7, all.size())) {
+    std::cout << "knn returned " << nearest.size() << " points\n";
+    return false;
+  }
+  for (size_t i = 0; i < nearest.size(); ++i) {
+    if (MBB<int32_t>(nearest[i], nearest[i]).distanceSquared(center) !=
+            distances[i] ||
+        !expected.contains(
+            {nearest[i].getX().getValue(), nearest[i].getY().getValue()})) {
+      std::cout << "knn result " << i << " differs from the reference\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+auto testLsmMatchesReference() -> bool {
+  // A tiny buffer and a small grid, so removes keep hitting copies that
+  // already sit in older runs and tombstones meet their points in merges
+  constexpr int32_t range = 150;
+  std::mt19937 rng(32);
+  LsmOptions options;
+  options.bufferCapacity = 64;
+  options.minChildren = 2;
+  options.maxChildren = 5;
+  LsmRTree<int32_t> tree(options);
+  Reference expected;
+  std::vector<Point<int32_t>> inserted;
+
+  for (int i = 0; i < 8000; ++i) {
+    if (inserted.empty() || rng() % 3 != 0) {
+      Point<int32_t> point(randomCoordinate(rng, 0, range),
+                           randomCoordinate(rng, 0, range));
+      tree.insert(point);
+      expected.insert({point.getX().getValue(), point.getY().getValue()});
+      inserted.push_back(point);
+    } else {
+      // Mostly points inserted before, some never stored or already gone
+      Point<int32_t> point =
+          rng() % 5 != 0 ? inserted[rng() % inserted.size()]
+                         : Point<int32_t>(randomCoordinate(rng, 0, range),
+                                          randomCoordinate(rng, 0, range));
+      tree.remove(point);
+      auto found =
+          expected.find({point.getX().getValue(), point.getY().getValue()});
+      if (found != expected.end()) {
+        expected.erase(found);
+      }
+    }
+    if (i % 500 == 0 && !matchesReference(tree, expected, rng, range)) {
+      return false;
+    }
+    if (i % 2000 == 1999) {
+      tree.flush();
+      if (!matchesReference(tree, expected, rng, range)) {
+        std::cout << "LsmRTree differs after flush()\n";
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+auto testShardRouting() -> bool {
+  using P = Point<int32_t>;
+  auto grid =
+      SpatialPartition<int32_t>::grid(MBB<int32_t>(P(0, 0), P(300, 400)), 3, 4);
+  std::mt19937 rng(33);
+  std::vector<P> sample;
+  for (int i = 0; i < 1000; ++i) {
+    sample.emplace_back(randomCoordinate(rng, -500, 500),
+                        randomCoordinate(rng, -50, 50));
+  }
+  auto quantiles = SpatialPartition<int32_t>::quantiles(sample, 6);
+  if (grid.size() != 12 || quantiles.size() != 6) {
+    std::cout << "Partitions have " << grid.size() << " and "
+              << quantiles.size() << " regions\n";
+    return false;
+  }
+
+  // Every point lands in the region of its shard, including points outside
+  // the domain and on the cuts, which belong to the region above them
+  for (const auto *partition : {&grid, &quantiles}) {
+    std::vector<size_t> load(partition->size());
+    for (int i = 0; i < 2000; ++i) {
+      P point(randomCoordinate(rng, -1000, 1000),
+              randomCoordinate(rng, -1000, 1000));
+      size_t shard = partition->shardOf(point);
+      if (!partition->region(shard).contains(point)) {
+        std::cout << point << " routed outside its region\n";
+        return false;
+      }
+    }
+    for (const auto &point : sample) {
+      ++load[partition->shardOf(point)];
+    }
+    if (partition == &quantiles &&
+        *std::min_element(load.begin(), load.end()) < 100) {
+      std::cout << "Quantile regions are unbalanced\n";
+      return false;
+    }
+  }
+  return grid.shardOf(P(100, 0)) == 4 && grid.shardOf(P(99, 99)) == 0 &&
+         grid.shardOf(P(99, 100)) == 1 && grid.shardOf(P(-5, 500)) == 3;
+}
+
+auto testShardedFlush() -> bool {
+  std::mt19937 rng(330);
+  auto partition = SpatialPartition<int32_t>::grid(
+      MBB<int32_t>(Point<int32_t>(0, 0), Point<int32_t>(1000, 1000)), 4, 4);
+  ShardedOptions options;
+  // Small queues, so producers also wait for the writers
+  options.queueCapacity = 64;
+  ShardedRTree<int32_t> tree(partition, options);
+  std::vector<std::vector<Point<int32_t>>> batches(4);
+  for (auto &batch : batches) {
+    for (int i = 0; i < 3000; ++i) {
+      batch.emplace_back(randomCoordinate(rng, 0, 1000),
+                         randomCoordinate(rng, 0, 1000));
+    }
+  }
+  std::vector<std::thread> producers;
+  for (const auto &batch : batches) {
+    producers.emplace_back([&tree, &batch] {
+      for (const auto &point : batch) {
+        tree.insert(point);
+      }
+    });
+  }
+  for (auto &producer : producers) {
+    producer.join();
+  }
+  for (size_t i = 0; i < 1000; ++i) {
+    tree.remove(batches[0][i]);
+  }
+
+  // Everything queued is visible as soon as flush() returns
+  tree.flush();
+  Reference expected;
+  for (const auto &batch : batches) {
+    for (const auto &point : batch) {
+      expected.insert({point.getX().getValue(), point.getY().getValue()});
+    }
+  }
+  for (size_t i = 0; i < 1000; ++i) {
+    const auto &point = batches[0][i];
+    expected.erase(
+        expected.find({point.getX().getValue(), point.getY().getValue()}));
+  }
+  if (tree.size() != expected.size() || !tree.search(batches[3].back())) {
+    std::cout << "flush() returned with " << tree.size() << " of "
+              << expected.size() << " points applied\n";
+    return false;
+  }
+  return matchesReference(tree, expected, rng, 1000);
+}
+
+auto testShardedKnnBound() -> bool {
+  // Four points per shard of a 4x4 grid over [0, 400). Nearest neighbours
+  // sit across a cut or need many shards, so stopping early at the wrong
+  // region distance would return a farther point.
+  using P = Point<int32_t>;
+  auto partition =
+      SpatialPartition<int32_t>::grid(MBB<int32_t>(P(0, 0), P(400, 400)), 4, 4);
+  ShardedRTree<int32_t> tree(partition);
+  std::vector<P> points;
+  for (int32_t x = 10; x < 400; x += 50) {
+    for (int32_t y = 10; y < 400; y += 50) {
+      points.emplace_back(x + (y % 100 == 10 ? 0 : 38), y);
+      tree.insert(points.back());
+    }
+  }
+  tree.flush();
+
+  std::vector<P> centers = {P(99, 99),   P(100, 100), P(101, 250),
+                            P(200, 10),  P(-50, 200), P(1000, 1000),
+                            P(250, 250), P(48, 61)};
+  for (const auto &center : centers) {
+    std::vector<double> distances;
+    for (const auto &point : points) {
+      distances.push_back(MBB<int32_t>(point, point).distanceSquared(center));
+    }
+    std::sort(distances.begin(), distances.end());
+    for (size_t k : {size_t{1}, size_t{3}, size_t{10}, points.size() + 5}) {
+      auto nearest = tree.knn(center, k);
+      if (nearest.size() != std::min(k, points.size())) {
+        std::cout << "knn(" << center << ", " << k << ") returned "
+                  << nearest.size() << " points\n";
+        return false;
+      }
+      for (size_t i = 0; i < nearest.size(); ++i) {
+        if (MBB<int32_t>(nearest[i], nearest[i]).distanceSquared(center) !=
+            distances[i]) {
+          std::cout << "knn(" << center << ", " << k << ") result " << i
+                    << " is too far\n";
+          return false;
+        }
+      }
+    }
+  }
+  return tree.knn(P(0, 0), 0).empty();
+}
+
+auto testConcurrentStress() -> bool {
+  // Writers insert their own points and remove every fourth one again while
+  // readers look up points that stay. Writer w owns the y range
+  // [w * n, (w + 1) * n), so a reader can query a slice of it.
+  constexpr int writers = 8;
+  constexpr int64_t n = 3000;
+  ConcurrentRTree<int64_t> tree(2, 6);
+  std::vector<std::vector<Point<int64_t>>> points(writers);
+  for (int w = 0; w < writers; ++w) {
+    std::mt19937 rng(static_cast<uint32_t>(w));
+    for (int64_t j = 0; j < n; ++j) {
+      points[w].emplace_back(randomCoordinate<int64_t>(rng, 0, 100000),
+                             w * n + j);
+    }
+  }
+  auto removed = [](int64_t j) { return j % 4 == 0 && j + 4 < n; };
+
+  std::vector<std::atomic<int64_t>> inserted(writers);
+  std::atomic<bool> stop{false};
+  std::atomic<size_t> failures{0};
+  std::vector<std::thread> threads;
+  for (int w = 0; w < writers; ++w) {
+    threads.emplace_back([&, w] {
+      for (int64_t j = 0; j < n; ++j) {
+        tree.insert(points[w][j]);
+        inserted[w] = j + 1;
+        if (j >= 4 && removed(j - 4) && !tree.remove(points[w][j - 4])) {
+          ++failures;
+        }
+      }
+    });
+  }
+  for (int r = 0; r < 2; ++r) {
+    threads.emplace_back([&, r] {
+      std::mt19937 rng(static_cast<uint32_t>(100 + r));
+      while (!stop) {
+        int w = static_cast<int>(rng() % writers);
+        int64_t done = inserted[w];
+        if (done < 8) {
+          continue;
+        }
+        int64_t j = static_cast<int64_t>(rng() % static_cast<uint64_t>(done));
+        if (removed(j)) {
+          continue;
+        }
+        const Point<int64_t> &point = points[w][j];
+        int64_t x = point.getX().getValue();
+        auto found = tree.query(QueryBox<int64_t>(
+            Point<int64_t>(x - 50, w * n), Point<int64_t>(x + 50, w * n + j)));
+        if (!tree.search(point) ||
+            std::find(found.begin(), found.end(), point) == found.end()) {
+          ++failures;
+        }
+      }
+    });
+  }
+  for (int w = 0; w < writers; ++w) {
+    threads[static_cast<size_t>(w)].join();
+  }
+  stop = true;
+  for (size_t i = writers; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+
+  size_t expected = 0;
+  for (int w = 0; w < writers; ++w) {
+    for (int64_t j = 0; j < n; ++j) {
+      if (tree.search(points[w][j]) == removed(j)) {
+        ++failures;
+      }
+      expected += removed(j) ? 0 : 1;
+    }
+  }
+  QueryBox<int64_t> all(Point<int64_t>(0, 0),
+                        Point<int64_t>(100000, writers * n));
+  if (failures != 0 || tree.size() != expected ||
+      tree.query(all).size() != expected || tree.count(all) != expected) {
+    std::cout << failures << " failed lookups, " << tree.size() << " of "
+              << expected << " points\n";
+    return false;
+  }
+  return tree.isValid();
+}
+
+auto testSearchBatch() -> bool {
+  std::mt19937 rng(35);
+  std::uniform_real_distribution<float> dist(0.0F, static_cast<float>(RANGE));
+  std::vector<Point<float>> points;
+  for (size_t i = 0; i < 3000; ++i) {
+    points.emplace_back(dist(rng), dist(rng));
+  }
+  RTree<float> inserted(2, 4);
+  for (size_t i = 0; i < 1000; ++i) {
+    inserted.insert(points[i]);
+  }
+  RTree<float> packed = RTree<float>::bulkLoad(points, 4, 16);
+  RTree<float> empty;
+
+  // Half stored points, some of them repeated, half random misses
+  std::vector<Point<float>> lookups;
+  for (size_t i = 0; i < 400; ++i) {
+    lookups.push_back(i % 2 == 0 ? points[rng() % 1500]
+                                 : Point<float>(dist(rng), dist(rng)));
+  }
+  for (auto *tree : {&inserted, &packed, &empty}) {
+    std::vector<bool> expected;
+    for (const auto &point : lookups) {
+      expected.push_back(tree->search(point));
+    }
+    // 0 is treated as 1; the last two exceed the number of lookups
+    for (size_t inFlight : {size_t{0}, size_t{1}, size_t{2}, size_t{7},
+                            lookups.size(), lookups.size() + 50}) {
+      if (tree->searchBatch(lookups, inFlight) != expected) {
+        std::cout << "searchBatch with " << inFlight
+                  << " lookups in flight differs from search\n";
+        return false;
+      }
+    }
+    if (!tree->searchBatch({}, 8).empty()) {
+      std::cout << "searchBatch of nothing returned results\n";
+      return false;
+    }
+  }
+  std::vector<Point<float>> one = {points[0]};
+  return packed.searchBatch(one, 16) == std::vector<bool>{true};
+}
+
+// Checks boxes, subtree counts and fill bounds below `node` and returns the
+// number of points it holds, or nothing if a check failed
+template <Coordinate T>
+auto checkSubtree(const RNode<T> *node, size_t minChildren,
+                  size_t maxChildren) -> std::optional<size_t> {
+  bool isRoot = node->getParent() == nullptr;
+  size_t entries = node->isLeaf ? node->getPoints().size()
+                                : node->getChildren().size();
+  if (entries > maxChildren || (!isRoot && entries < minChildren)) {
+    std::cout << "Node with " << entries << " entries\n";
+    return std::nullopt;
+  }
+  size_t total = 0;
+  if (node->isLeaf) {
+    for (const auto &point : node->getPoints()) {
+      if (!node->getBoundingBox().contains(point)) {
+        std::cout << "Point " << point << " outside its leaf\n";
+        return std::nullopt;
+      }
+    }
+    total = entries;
+  } else {
+    for (const auto *child : node->getChildren()) {
+      auto count = checkSubtree(child, minChildren, maxChildren);
+      if (!count.has_value() ||
+          !node->getBoundingBox().contains(child->getBoundingBox())) {
+        return std::nullopt;
+      }
+      total += *count;
+    }
+  }
+  if (node->getCount() != total) {
+    std::cout << "Subtree count " << node->getCount() << " instead of "
+              << total << '\n';
+    return std::nullopt;
+  }
+  return total;
+}
+
+template <Coordinate T> auto nodeCount(const RNode<T> *node) -> size_t {
+  size_t result = 1;
+  for (const auto *child : node->getChildren()) {
+    result += nodeCount(child);
+  }
+  return result;
+}
+
+// The leaf storing `point`, or null
+template <Coordinate T>
+auto leafOf(const RNode<T> *node, const Point<T> &point) -> const RNode<T> * {
+  if (node->isLeaf) {
+    auto points = node->getPoints();
+    auto found = std::find(points.begin(), points.end(), point);
+    return found != points.end() ? node : nullptr;
+  }
+  for (const auto *child : node->getChildren()) {
+    if (child->getBoundingBox().contains(point)) {
+      if (const auto *leaf = leafOf(child, point)) {
+        return leaf;
+      }
+    }
+  }
+  return nullptr;
+}
+
+auto testUpdateMatchesReference() -> bool {
+  // Distinct points on a large grid, so the leaf holding a point is unique.
+  // Each move is classified by its effect: same leaf means in place, a new
+  // leaf with an unchanged node count means it went down from an ancestor,
+  // and a changed node count means it fell back to remove() and insert().
+  using P = Point<int32_t>;
+  constexpr int32_t range = 100000;
+  std::mt19937 rng(36);
+  RTree<int32_t> tree(2, 6);
+  std::set<std::pair<int32_t, int32_t>> expected;
+  std::vector<P> points;
+  auto key = [](const P &point) {
+    return std::make_pair(point.getX().getValue(), point.getY().getValue());
+  };
+  while (points.size() < 800) {
+    P point(randomCoordinate(rng, 0, range), randomCoordinate(rng, 0, range));
+    if (expected.insert(key(point)).second) {
+      points.push_back(point);
+      tree.insert(point);
+    }
+  }
+
+  size_t inPlace = 0;
+  size_t moved = 0;
+  size_t fallbacks = 0;
+  for (int step = 0; step < 4000; ++step) {
+    size_t i = rng() % points.size();
+    int32_t x = points[i].getX().getValue();
+    int32_t y = points[i].getY().getValue();
+    P to = step % 3 == 0 ? P(randomCoordinate(rng, 0, range),
+                             randomCoordinate(rng, 0, range))
+                         : P(x + randomCoordinate(rng, -40, 40),
+                             y + randomCoordinate(rng, -40, 40));
+    if (expected.contains(key(to))) {
+      continue;
+    }
+
+    // Every 500 steps a snapshot shares the whole tree, so the next moves
+    // have to copy the nodes they touch
+    std::optional<RTree<int32_t>> snapshot;
+    std::vector<std::pair<int32_t, int32_t>> before;
+    if (step % 500 == 0) {
+      snapshot.emplace(tree.share());
+      before = contents(*snapshot);
+    }
+    const RNode<int32_t> *source = leafOf(tree.getRoot(), points[i]);
+    size_t nodes = nodeCount(tree.getRoot());
+    if (!tree.update(points[i], to, static_cast<int32_t>(step % 3 * 8))) {
+      std::cout << "update() did not find " << points[i] << '\n';
+      return false;
+    }
+    if (snapshot.has_value()) {
+      if (contents(*snapshot) != before) {
+        std::cout << "update() changed a shared snapshot\n";
+        return false;
+      }
+    } else if (nodeCount(tree.getRoot()) != nodes) {
+      ++fallbacks;
+    } else if (leafOf(tree.getRoot(), to) == source) {
+      ++inPlace;
+    } else {
+      ++moved;
+    }
+    expected.erase(key(points[i]));
+    expected.insert(key(to));
+    points[i] = to;
+
+    if (step % 250 == 0) {
+      if (!checkSubtree(tree.getRoot(), 2, 6).has_value() ||
+          contents(tree) != std::vector(expected.begin(), expected.end())) {
+        std::cout << "Tree differs from the reference after step " << step
+                  << '\n';
+        return false;
+      }
+    }
+  }
+  if (tree.update(P(-1, -1), P(0, 0)) || tree.size() != points.size()) {
+    std::cout << "update() of a missing point changed the tree\n";
+    return false;
+  }
+  if (inPlace == 0 || moved == 0 || fallbacks == 0) {
+    std::cout << "update() branches taken: " << inPlace << " in place, "
+              << moved << " moved, " << fallbacks << " fallbacks\n";
+    return false;
+  }
+
+  // The tolerance around a leaf at the limits of int32 must not overflow
+  constexpr int32_t lowest = std::numeric_limits<int32_t>::min();
+  constexpr int32_t highest = std::numeric_limits<int32_t>::max();
+  RTree<int32_t> edges(2, 6);
+  for (int32_t i = 0; i < 20; ++i) {
+    edges.insert(P(lowest + i, lowest + i));
+    edges.insert(P(highest - i, highest - i));
+  }
+  if (!edges.update(P(highest, highest), P(highest, highest - 100), 5) ||
+      !edges.update(P(lowest, lowest), P(lowest + 100, lowest), 5) ||
+      !edges.search(P(highest, highest - 100)) ||
+      !edges.search(P(lowest + 100, lowest)) || edges.size() != 40 ||
+      !checkSubtree(edges.getRoot(), 2, 6).has_value()) {
+    std::cout << "update() at the int32 limits failed\n";
+    return false;
+  }
+  return checkSubtree(tree.getRoot(), 2, 6).has_value() &&
+         contents(tree) == std::vector(expected.begin(), expected.end());
+}
+
+auto testHilbertMatchesReference(uint minChildren, uint maxChildren) -> bool {
+  // Some points fall outside the domain and are clamped to its border
+  using P = Point<int32_t>;
+  std::mt19937 rng(37 + maxChildren);
+  HilbertRTree<int32_t> tree(MBB<int32_t>(P(0, 0), P(1000, 1000)),
+                             minChildren, maxChildren);
+  std::vector<P> live;
+  auto fail = [&](const char *what) {
+    std::cout << "HilbertRTree " << minChildren << "/" << maxChildren << ": "
+              << what << " with " << live.size() << " points\n";
+    return false;
+  };
+  auto check = [&]() {
+    if (!tree.isValid() || tree.size() != live.size()) {
+      return fail("invalid tree");
+    }
+    for (int i = 0; i < 10; ++i) {
+      QueryBox<int32_t> q = randomBox<int32_t>(rng, -100, 1100);
+      auto expected = contents(bruteQuery(live, q));
+      if (contents(tree.query(q)) != expected ||
+          tree.count(q) != expected.size()) {
+        return fail("query or count differs");
+      }
+    }
+    for (size_t i = 0; i < live.size(); i += 13) {
+      if (!tree.search(live[i])) {
+        return fail("stored point not found");
+      }
+    }
+    return true;
+  };
+
+  for (int step = 0; step < 8000; ++step) {
+    if (live.empty() || step < 3000 || rng() % 3 != 0) {
+      live.emplace_back(randomCoordinate(rng, -50, 1050),
+                        randomCoordinate(rng, -50, 1050));
+      tree.insert(live.back());
+    } else {
+      size_t i = rng() % live.size();
+      if (!tree.remove(live[i])) {
+        return fail("remove() missed a stored point");
+      }
+      live[i] = live.back();
+      live.pop_back();
+    }
+    if (step % 500 == 0 && !check()) {
+      return false;
+    }
+  }
+  if (!check() || tree.remove(P(5000, 5000))) {
+    return fail("final check failed");
+  }
+
+  // Shrink back to nothing through every underflow case
+  while (!live.empty()) {
+    if (!tree.remove(live.back())) {
+      return fail("remove() missed a stored point");
+    }
+    live.pop_back();
+    if (live.size() % 401 == 0 && !check()) {
+      return false;
+    }
+  }
+  return tree.size() == 0 && tree.height() == 1;
+}
+
+template <Coordinate T>
+auto testCacheMatchesTree(T range, T quantum, T step) -> bool {
+  // A budget of a few results forces evictions; queries come from a small
+  // pool, shifted by less than a grid cell or shrunk, so they hit exact and
+  // superset entries. Writes land inside cached boxes and must drop them.
+  std::mt19937 rng(38);
+  QueryCacheOptions<T> options;
+  options.capacityBytes = 16384;
+  options.quantum = quantum;
+  CachedRTree<T> cached(2, 8, options);
+  RTree<T> plain(2, 8);
+  std::vector<Point<T>> points;
+  auto randomPoint = [&]() {
+    return Point<T>(randomCoordinate<T>(rng, 0, range),
+                    randomCoordinate<T>(rng, 0, range));
+  };
+  for (int i = 0; i < 1500; ++i) {
+    points.push_back(randomPoint());
+    cached.insert(points.back());
+    plain.insert(points.back());
+  }
+  std::vector<QueryBox<T>> pool;
+  for (int i = 0; i < 40; ++i) {
+    pool.push_back(randomBox<T>(rng, 0, range));
+  }
+
+  for (int i = 0; i < 3000; ++i) {
+    switch (rng() % 8) {
+    case 0: {
+      points.push_back(randomPoint());
+      cached.insert(points.back());
+      plain.insert(points.back());
+      break;
+    }
+    case 1: {
+      size_t victim = rng() % points.size();
+      cached.remove(points[victim]);
+      plain.remove(points[victim]);
+      points[victim] = points.back();
+      points.pop_back();
+      break;
+    }
+    case 2: {
+      size_t moving = rng() % points.size();
+      Point<T> to = randomPoint();
+      if (cached.update(points[moving], to) !=
+          plain.update(points[moving], to)) {
+        std::cout << "update() results differ\n";
+        return false;
+      }
+      points[moving] = to;
+      break;
+    }
+    default: {
+      const MBB<T> &box = pool[rng() % pool.size()].getMBB();
+      T low = randomCoordinate<T>(rng, 0, step);
+      T high = randomCoordinate<T>(rng, 0, step);
+      // Shifted by less than a cell, or shrunk to a box inside it
+      QueryBox<T> q =
+          rng() % 2 == 0
+              ? QueryBox<T>(box.lowerLeft + Point<T>(low, low),
+                            box.upperRight + Point<T>(low, low))
+              : QueryBox<T>(box.lowerLeft + Point<T>(low, low),
+                            box.upperRight - Point<T>(high, high));
+      if (contents(cached.query(q)) != contents(plain.query(q))) {
+        std::cout << "Cached query differs from the tree after " << i
+                  << " operations\n";
+        return false;
+      }
+    }
+    }
+    if (cached.cacheBytes() > options.capacityBytes) {
+      std::cout << "Cache holds " << cached.cacheBytes() << " bytes\n";
+      return false;
+    }
+  }
+
+  const QueryCacheStats &stats = cached.stats();
+  if (stats.hits == 0 || stats.supersetHits == 0 || stats.misses == 0 ||
+      stats.evictions == 0 || stats.invalidations == 0) {
+    std::cout << "Cache paths not taken: " << stats.hits << " hits, "
+              << stats.supersetHits << " superset hits, " << stats.evictions
+              << " evictions, " << stats.invalidations << " invalidations\n";
+    return false;
+  }
+
+  // Keys of boxes reaching the limits of an integral type round outward
+  // past them, so they have to clamp rather than overflow
+  if constexpr (std::integral<T>) {
+    constexpr T lowest = std::numeric_limits<T>::lowest();
+    constexpr T highest = std::numeric_limits<T>::max();
+    const Point<T> low(lowest, lowest);
+    const Point<T> origin(0, 0);
+    const Point<T> high(highest, highest);
+    for (const auto &q : {QueryBox<T>(origin, high), QueryBox<T>(low, high),
+                          QueryBox<T>(low, Point<T>(range, range))}) {
+      // The second round is answered from the cache
+      for (int round = 0; round < 2; ++round) {
+        if (contents(cached.query(q)) != contents(plain.query(q))) {
+          std::cout << "Cached query up to the type limits differs\n";
+          return false;
+        }
+      }
+    }
+  }
+  return cached.size() == plain.size();
+}
+
+template <Coordinate T> auto testFreezeMatches(T low, T high) -> bool {
+  std::mt19937 rng(39);
+  std::vector<Point<T>> points = randomPoints(rng, 3000, low, high);
+  RTree<T> inserted(2, 6);
+  for (const auto &point : points) {
+    inserted.insert(point);
+  }
+  for (size_t i = 0; i < 500; ++i) {
+    inserted.remove(points[i]);
+  }
+  RTree<T> packed = RTree<T>::bulkLoad(points, 4, 16);
+  RTree<T> empty(2, 6);
+
+  for (auto *tree : {&inserted, &packed, &empty}) {
+    FrozenRTree<T> frozen = tree->freeze();
+    if (frozen.size() != tree->size()) {
+      std::cout << "Frozen tree holds " << frozen.size() << " of "
+                << tree->size() << " points\n";
+      return false;
+    }
+    for (size_t i = 0; i < 200; ++i) {
+      Point<T> point = i % 2 == 0 ? points[rng() % points.size()]
+                                  : Point<T>(randomCoordinate(rng, low, high),
+                                             randomCoordinate(rng, low, high));
+      if (frozen.search(point) != tree->search(point)) {
+        std::cout << "Frozen search differs for " << point << '\n';
+        return false;
+      }
+    }
+    for (size_t i = 0; i < 100; ++i) {
+      T top = i % 2 == 0 ? high : clusterTop(low, high);
+      QueryBox<T> q = randomBox(rng, low, top);
+      if (contents(frozen.query(q)) != contents(tree->query(q)) ||
+          frozen.count(q) != tree->count(q)) {
+        std::cout << "Frozen query or count differs\n";
+        return false;
+      }
+    }
+    for (size_t k : {size_t{1}, size_t{10}, tree->size() + 1}) {
+      Point<T> center(randomCoordinate(rng, low, high),
+                      randomCoordinate(rng, low, high));
+      auto expected = tree->knn(center, k);
+      auto nearest = frozen.knn(center, k);
+      if (nearest.size() != expected.size()) {
+        std::cout << "Frozen knn returned " << nearest.size() << " of "
+                  << expected.size() << " points\n";
+        return false;
+      }
+      for (size_t i = 0; i < nearest.size(); ++i) {
+        if (MBB<T>(nearest[i], nearest[i]).distanceSquared(center) !=
+            MBB<T>(expected[i], expected[i]).distanceSquared(center)) {
+          std::cout << "Frozen knn result " << i << " differs\n";
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
 } // namespace
 
 auto main() -> int {
@@ -208,5 +1727,171 @@ auto main() -> int {
     std::cout << "Test Children In Parent MBB: Failed\n";
   }
 
+  if (testCountMatchesQuery(tree)) {
+    std::cout << "Test Count Matches Query: Passed\n";
+  } else {
+    std::cout << "Test Count Matches Query: Failed\n";
+  }
+
+  if (testAggregateMatchesQuery()) {
+    std::cout << "Test Aggregate Matches Query: Passed\n";
+  } else {
+    std::cout << "Test Aggregate Matches Query: Failed\n";
+  }
+
+  if (testSmallStackSpill()) {
+    std::cout << "Test SmallStack Spill: Passed\n";
+  } else {
+    std::cout << "Test SmallStack Spill: Failed\n";
+  }
+
+  if (testWideTreeWalk()) {
+    std::cout << "Test Wide Tree Walk: Passed\n";
+  } else {
+    std::cout << "Test Wide Tree Walk: Failed\n";
+  }
+
+  if (testDegenerateTree()) {
+    std::cout << "Test Degenerate Tree: Passed\n";
+  } else {
+    std::cout << "Test Degenerate Tree: Failed\n";
+  }
+
+  if (testCopyOnWrite()) {
+    std::cout << "Test Copy On Write: Passed\n";
+  } else {
+    std::cout << "Test Copy On Write: Failed\n";
+  }
+
+  if (testCloneMoved()) {
+    std::cout << "Test Clone Moved: Passed\n";
+  } else {
+    std::cout << "Test Clone Moved: Failed\n";
+  }
+
+  if (testSharedRelease()) {
+    std::cout << "Test Shared Release: Passed\n";
+  } else {
+    std::cout << "Test Shared Release: Failed\n";
+  }
+
+  if (testCompactMatches<float, uint8_t>(-1000.0F, 1000.0F) &&
+      testCompactMatches<double, uint16_t>(0.0, 1.0) &&
+      testCompactMatches<int32_t, uint8_t>(-1000000000, 1000000000) &&
+      testCompactMatches<int64_t, uint16_t>(-(int64_t{1} << 62),
+                                            int64_t{1} << 62)) {
+    std::cout << "Test Compact Matches Tree: Passed\n";
+  } else {
+    std::cout << "Test Compact Matches Tree: Failed\n";
+  }
+
+  if (testCoordinateType<double>(-1.0e6, 1.0e6) &&
+      testCoordinateType<int32_t>(-1000, 1000) &&
+      testCoordinateType<int64_t>(-(int64_t{1} << 62), int64_t{1} << 62)) {
+    std::cout << "Test Coordinate Types: Passed\n";
+  } else {
+    std::cout << "Test Coordinate Types: Failed\n";
+  }
+
+  if (testIntegralArea()) {
+    std::cout << "Test Integral Area: Passed\n";
+  } else {
+    std::cout << "Test Integral Area: Failed\n";
+  }
+
+  if (testExactIntegers()) {
+    std::cout << "Test Exact Integers: Passed\n";
+  } else {
+    std::cout << "Test Exact Integers: Failed\n";
+  }
+
+  if (testWalReplay()) {
+    std::cout << "Test WAL Replay: Passed\n";
+  } else {
+    std::cout << "Test WAL Replay: Failed\n";
+  }
+
+  if (testTornTail()) {
+    std::cout << "Test Torn Tail: Passed\n";
+  } else {
+    std::cout << "Test Torn Tail: Failed\n";
+  }
+
+  if (testCheckpointRecovery()) {
+    std::cout << "Test Checkpoint Recovery: Passed\n";
+  } else {
+    std::cout << "Test Checkpoint Recovery: Failed\n";
+  }
+
+  if (testFailedCheckpoint()) {
+    std::cout << "Test Failed Checkpoint: Passed\n";
+  } else {
+    std::cout << "Test Failed Checkpoint: Failed\n";
+  }
+
+  if (testLsmMatchesReference()) {
+    std::cout << "Test Lsm Matches Reference: Passed\n";
+  } else {
+    std::cout << "Test Lsm Matches Reference: Failed\n";
+  }
+
+  if (testShardRouting()) {
+    std::cout << "Test Shard Routing: Passed\n";
+  } else {
+    std::cout << "Test Shard Routing: Failed\n";
+  }
+
+  if (testShardedFlush()) {
+    std::cout << "Test Sharded Flush: Passed\n";
+  } else {
+    std::cout << "Test Sharded Flush: Failed\n";
+  }
+
+  if (testShardedKnnBound()) {
+    std::cout << "Test Sharded Knn Bound: Passed\n";
+  } else {
+    std::cout << "Test Sharded Knn Bound: Failed\n";
+  }
+
+  if (testConcurrentStress()) {
+    std::cout << "Test Concurrent Stress: Passed\n";
+  } else {
+    std::cout << "Test Concurrent Stress: Failed\n";
+  }
+
+  if (testSearchBatch()) {
+    std::cout << "Test Search Batch: Passed\n";
+  } else {
+    std::cout << "Test Search Batch: Failed\n";
+  }
+
+  if (testUpdateMatchesReference()) {
+    std::cout << "Test Update Matches Reference: Passed\n";
+  } else {
+    std::cout << "Test Update Matches Reference: Failed\n";
+  }
+
+  if (testHilbertMatchesReference(2, 3) &&
+      testHilbertMatchesReference(3, 6) &&
+      testHilbertMatchesReference(4, 16)) {
+    std::cout << "Test Hilbert Matches Reference: Passed\n";
+  } else {
+    std::cout << "Test Hilbert Matches Reference: Failed\n";
+  }
+
+  if (testCacheMatchesTree<float>(static_cast<float>(RANGE), 0.5F, 0.2F) &&
+      testCacheMatchesTree<int32_t>(100000, 64, 40)) {
+    std::cout << "Test Cache Matches Tree: Passed\n";
+  } else {
+    std::cout << "Test Cache Matches Tree: Failed\n";
+  }
+
+  if (testFreezeMatches<float>(0.0F, static_cast<float>(RANGE)) &&
+      testFreezeMatches<int64_t>(-(int64_t{1} << 40), int64_t{1} << 40)) {
+    std::cout << "Test Freeze Matches Tree: Passed\n";
+  } else {
+    std::cout << "Test Freeze Matches Tree: Failed\n";
+  }
+
   return 0;
 }